@@ -47,9 +47,18 @@
 ---@field PQSHOW_CONTEXT_ERRORS number
 ---@field PQSHOW_CONTEXT_ALWAYS number
 ---@field connect fun(url: string, callback: fun(ok: boolean, conn: PGconn|string))
+---@field setTickBudget fun(microseconds: number) limits how long results are processed in one tick, the rest is processed in the next ticks (0 = unlimited, default)
+---@field getTickBudget fun(): number
+---@field stats fun(): PGStats metrics of all connections
+---@field waitAll fun(conns: PGconn[], timeout: number?): boolean waits until every connection finishes its queries and resets, returns false if timeout (in milliseconds) has passed
+---@field waitAny fun(conns: PGconn[], timeout: number?): boolean waits until any connection finishes its queries and resets, returns false if timeout (in milliseconds) has passed
+---@field setResultCacheSize fun(bytes: number) limits memory used by results of `queryCached`, least recently used results are removed (0 = disabled, default)
+---@field resultCacheStats fun(): PGResultCacheStats
+---@field invalidateResultCache fun(tag: string?) removes cached results with given tag, or every result if tag is not given
 
 ---@alias PGAllowedParam string | number | boolean | nil
----@alias PGQueryCallback fun(ok: boolean, result: PGResult|string, errdata: table?)
+---@alias PGCopySource (string|number|boolean?)[][] | fun(): (string|number|boolean?)[]?
+---@alias PGQueryCallback fun(ok: boolean, result: PGResult|PGLazyResult|string, errdata: table?)
 ---@alias PGConnStatus `async_postgres.CONNECTION_OK` | `async_postgres.CONNECTION_BAD`
 ---@alias PGTransStatus `async_postgres.PQTRANS_IDLE` | `async_postgres.PQTRANS_ACTIVE` | `async_postgres.PQTRANS_INTRANS` | `async_postgres.PQTRANS_INERROR` | `async_postgres.PQTRANS_UNKNOWN`
 ---@alias PGErrorVerbosity `async_postgres.PQERRORS_TERSE` | `async_postgres.PQERRORS_DEFAULT` | `async_postgres.PQERRORS_VERBOSE` | `async_postgres.PQERRORS_SQLSTATE`
@@ -58,6 +67,11 @@
 ---@class PGconn
 ---@field query             fun(self: PGconn, query: string, callback: PGQueryCallback)
 ---@field queryParams       fun(self: PGconn, query: string, params: PGAllowedParam[], callback: PGQueryCallback)
+---@field queryCached       fun(self: PGconn, query: string, params: PGAllowedParam[], ttl: number, tags: string[]?, callback: PGQueryCallback)
+---@field executeMany       fun(self: PGconn, query: string, paramsList: PGAllowedParam[][], callback: fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?))
+---@field executeManyPrepared fun(self: PGconn, name: string, paramsList: PGAllowedParam[][], callback: fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?))
+---@field copyFrom          fun(self: PGconn, query: string, source: PGCopySource, callback: PGQueryCallback)
+---@field copyToFile        fun(self: PGconn, query: string, path: string, callback: fun(ok: boolean, result: PGCopyResult|string))
 ---@field prepare           fun(self: PGconn, name: string, query: string, callback: PGQueryCallback)
 ---@field queryPrepared     fun(self: PGconn, name: string, params: PGAllowedParam[], callback: PGQueryCallback)
 ---@field describePrepared  fun(self: PGconn, name: string, callback: PGQueryCallback)
@@ -91,16 +105,96 @@
 ---@field unescapeBytea     fun(self: PGconn, str: string): string
 ---@field setNotifyCallback fun(self: PGconn, callback: fun(channel: string, payload: string, backendPID: number))
 ---@field getNotifyCallback fun(self: PGconn): fun(channel: string, payload: string, backendPID: number)
+---@field listen            fun(self: PGconn, channel: string, callback: fun(channel: string, payloads: string[]), coalesce: boolean?)
+---@field unlisten          fun(self: PGconn, channel: string)
 ---@field setNoticeCallback fun(self: PGconn, callback: fun(message: string, errdata: table))
 ---@field getNoticeCallback fun(self: PGconn): fun(message: string, errdata: table)
 ---@field setArrayResult    fun(self: PGconn, enabled: boolean)
 ---@field getArrayResult    fun(self: PGconn): boolean
+---@field setBinaryResult   fun(self: PGconn, enabled: boolean)
+---@field getBinaryResult   fun(self: PGconn): boolean
+---@field setLazyResult     fun(self: PGconn, enabled: boolean)
+---@field getLazyResult     fun(self: PGconn): boolean
+---@field setColumnarResult fun(self: PGconn, enabled: boolean)
+---@field getColumnarResult fun(self: PGconn): boolean
+---@field setStatementCache fun(self: PGconn, size: number)
+---@field getStatementCache fun(self: PGconn): number, number returns cache size and number of cached statements
+---@field setTypedParams    fun(self: PGconn, enabled: boolean, bytea: boolean?)
+---@field getTypedParams    fun(self: PGconn): boolean, boolean
+---@field setPinnedParams   fun(self: PGconn, size: number)
+---@field getPinnedParams   fun(self: PGconn): number
+---@field setQueryTimeout   fun(self: PGconn, timeout: number)
+---@field getQueryTimeout   fun(self: PGconn): number
+---@field cancel            fun(self: PGconn): boolean
+---@field setChunkSize      fun(self: PGconn, size: number)
+---@field getChunkSize      fun(self: PGconn): number
+---@field setThreadedIO     fun(self: PGconn, enabled: boolean)
+---@field getThreadedIO     fun(self: PGconn): boolean
+---@field setPipelineMode   fun(self: PGconn, enabled: boolean)
+---@field getPipelineMode   fun(self: PGconn): boolean
+---@field pendingQueries    fun(self: PGconn): number
+---@field outstandingQueries fun(self: PGconn): number
+---@field stats             fun(self: PGconn): PGStats
+---@field clearQueries      fun(self: PGconn, message: string?)
 
 ---@class PGResult
 ---@field fields { name: string, type: number }[] list of fields in the result
----@field rows table<string, string?>[]
+---@field rows table<string, string|number|boolean?>[] values are strings, unless binary result option is used
+---@field columns table<string, (string|number|boolean?)[]>? arrays of values of every column, only with columnar result option (rows are not created then)
+---@field count number? number of rows, only with columnar result option
 ---@field oid number oid of the inserted row, otherwise 0
 ---@field command string command of the query in format of COMMAND [NUM], e.g. SELECT 1
+---@field partial boolean? true if result is a chunk of rows from streaming query, and more rows will follow
+
+--- Summary of latency histogram, all values are in microseconds
+---@class PGLatencyStats
+---@field count number
+---@field mean number
+---@field p50 number
+---@field p90 number
+---@field p99 number
+---@field max number
+
+---@class PGStats
+---@field queue_time PGLatencyStats time from submission until query is sent
+---@field first_result_time PGLatencyStats time from sending until first result is received
+---@field total_time PGLatencyStats time from submission until query is done
+---@field callback_time PGLatencyStats time spent in query callbacks
+---@field queries number number of completed queries
+---@field queue_depth_max number highest number of queries in the queue
+---@field bytes_sent number bytes of SQL, parameters and COPY data
+---@field bytes_received number bytes of result values (estimated from sampled rows for big results) and COPY data
+---@field result_memory number total memory used by received results
+---@field rows number number of received rows
+
+---@class PGResultCacheStats
+---@field capacity number size limit in bytes
+---@field size number memory used by cached results in bytes
+---@field entries number
+---@field hits number
+---@field misses number
+
+---@class PGExecuteManyResult
+---@field affected number total number of rows affected by all executions
+---@field count number number of executions
+
+---@class PGCopyResult
+---@field command string e.g. COPY 100
+---@field rows number number of data rows written into the file
+---@field bytes number number of bytes written into the file
+
+--- Result which is returned when `lazy_result` option is used.
+--- Values are converted to lua only when they are accessed,
+--- `result[i]` and `result.rows[i]` build the row table every time they are called.
+---@class PGLazyResult
+---@field fields { name: string, type: number }[] list of fields in the result
+---@field rows PGLazyResult result itself, so `result.rows[i]` works like with PGResult
+---@field oid number oid of the inserted row, otherwise 0
+---@field command string command of the query in format of COMMAND [NUM], e.g. SELECT 1
+---@field row fun(self: PGLazyResult, i: number): table? returns row table, or nil if row doesn't exist
+---@field get fun(self: PGLazyResult, i: number, column: number|string): any returns value of a single cell
+---@field iter fun(self: PGLazyResult): (fun(): number, table) iterator over rows, `for i, row in result:iter() do`
+---@field free fun(self: PGLazyResult) frees result memory, result can't be used after that
 
 if not util.IsBinaryModuleInstalled("async_postgres") then
     error("async_postgres module is not installed, " ..
@@ -156,19 +250,170 @@ function Queue.new()
 end
 
 ---@class PGQuery
----@field command 'query' | 'queryParams' | 'prepare' | 'queryPrepared' | 'describePrepared' | 'describePortal'
+---@field command 'query' | 'queryParams' | 'queryCached' | 'executeMany' | 'executeManyPrepared' | 'prepare' | 'queryPrepared' | 'describePrepared' | 'describePortal' | 'copyFrom' | 'copyToFile'
 ---@field name string?
 ---@field query string?
 ---@field params table?
+---@field ttl number?
+---@field tags string[]?
+---@field params_list table?
+---@field source PGCopySource?
+---@field path string?
+---@field chunk_size number?
+---@field raw boolean? result is received as binary array rows and params are sent untyped, regardless of client options
 ---@field callback PGQueryCallback
 
+-- default size of chunks which large objects are read and written with
+local LARGE_OBJECT_CHUNK_SIZE = 256 * 1024
+
+---@class PGLargeObject
+---@field client PGClient **readonly**
+---@field oid number **readonly**
+---@field private position number offset of the next read or write
+local LargeObject = {}
+
+---@private
+LargeObject.__index = LargeObject
+
+---@private
+function LargeObject:__tostring()
+    return string.format("PGLargeObject<%d at %d>", self.oid, self.position)
+end
+
+--- Moves position of the next read or write, nothing is sent to the server
+---@param offset number
+---@param whence 'set' | 'cur' | nil `set` (default) to set position, `cur` to move it relative to current one
+---@return number position
+function LargeObject:seek(offset, whence)
+    local position = whence == "cur" and self.position + offset or offset
+    if position < 0 then
+        error("large object position can't be negative")
+    end
+
+    self.position = position
+    return position
+end
+
+--- Returns position of the next read or write
+---@return number
+function LargeObject:tell()
+    return self.position
+end
+
+--- Reads data starting at current position in chunks with `lo_get`,
+--- one chunk is requested at a time, so big objects are received over many ticks
+--- and never held in a single lua string
+---
+--- Reading stops after `length` bytes or at the end of the object
+---@param length number? number of bytes to read, reads until the end if not given
+---@param onChunk fun(data: string, offset: number) called for every received chunk
+---@param callback fun(ok: boolean, result: number|string) called with number of bytes read or an error
+---@param chunkSize number? size of chunks (default: 256 KiB)
+function LargeObject:read(length, onChunk, callback, chunkSize)
+    chunkSize = chunkSize or LARGE_OBJECT_CHUNK_SIZE
+    local total = 0
+
+    local function readChunk()
+        local size = length and math.min(chunkSize, length - total) or chunkSize
+        if size <= 0 then
+            return callback(true, total)
+        end
+
+        local offset = self.position
+        self.client:queryRaw("SELECT pg_catalog.lo_get($1::oid, $2::int8, $3::int4)",
+            { self.oid, offset, size }, function(ok, result)
+                if not ok then
+                    return callback(false, result)
+                end
+
+                local data = result.rows[1][1]
+                self.position = offset + #data
+                total = total + #data
+                if #data > 0 then
+                    onChunk(data, offset)
+                end
+
+                -- short chunk means that end of the object was reached
+                if #data < size then
+                    return callback(true, total)
+                end
+                return readChunk()
+            end)
+    end
+
+    readChunk()
+end
+
+--- Writes data starting at current position in chunks with `lo_put`,
+--- data is sent as binary parameter, one chunk at a time
+---
+--- Source is either a string, which is split into chunks,
+--- or a function which returns next chunk (or nil when there is no more data)
+---
+--- Every chunk is a separate statement, so outside of a transaction
+--- chunks are committed one by one, and a failed write leaves already written chunks.
+--- Run it in a transaction if the write must be applied as a whole
+---@param source string | fun(): string?
+---@param callback fun(ok: boolean, result: number|string) called with number of bytes written or an error
+---@param chunkSize number? size of chunks of string source (default: 256 KiB)
+function LargeObject:write(source, callback, chunkSize)
+    chunkSize = chunkSize or LARGE_OBJECT_CHUNK_SIZE
+    local total = 0
+
+    local nextChunk = source
+    if type(source) == "string" then
+        local start = 1
+        nextChunk = function()
+            if start <= #source then
+                local chunk = source:sub(start, start + chunkSize - 1)
+                start = start + chunkSize
+                return chunk
+            end
+        end
+    end
+
+    local function writeChunk()
+        local ok, data = pcall(nextChunk)
+        if not ok then
+            return callback(false, data)
+        end
+        if data == nil or data == "" then
+            return callback(true, total)
+        end
+
+        local offset = self.position
+        self.client:queryRaw("SELECT pg_catalog.lo_put($1::oid, $2::int8, $3::bytea)",
+            { self.oid, offset, data }, function(ok, result)
+                if not ok then
+                    return callback(false, result)
+                end
+
+                self.position = offset + #data
+                total = total + #data
+                return writeChunk()
+            end)
+    end
+
+    writeChunk()
+end
+
 ---@class PGClient
 ---@field url string **readonly** connection url
 ---@field connecting boolean **readonly** is client connecting to the database
 ---@field closed boolean **readonly** is client closed (to change it to true use `:close()`)
 ---@field array_result boolean option to receive PGResult row fields as array instead of table (default: false)
+---@field lazy_result boolean option to receive PGLazyResult instead of PGResult, which converts values only when they are accessed (default: false)
+---@field columnar_result boolean option to receive PGResult with `columns` arrays (`result.columns.name[i]`) instead of `rows`, with `array_result` columns are indexed by number (default: false)
+---@field binary_result boolean option to receive results of queries with parameters in binary format, numbers, booleans, timestamps (as unix time), numerics and uuids will be converted to lua types, int8 and numeric values which don't fit into lua number exactly are returned as strings (default: false)
+---@field typed_params boolean option to send number and boolean parameters in binary format with explicit types (int8, float8, bool), and strings as text with type inferred by the server (default: false)
+---@field bytea_params boolean option to send string parameters as bytea when `typed_params` is enabled (default: false)
+---@field pinned_params number option to send string parameters of at least given size in bytes without copying them, strings are kept alive until the query is done (default: 0, disabled)
+---@field query_timeout number option to cancel queries which are running longer than given number of milliseconds, they fail with "query timed out" error (default: 0, disabled)
+---@field statement_cache number option to automatically prepare up to given number of `queryParams` queries, least recently used ones are deallocated (default: 0, disabled)
+---@field pipeline boolean option to send queued queries without waiting for previous ones to finish, `query` can't run several statements at once in this mode (default: false)
+---@field threaded_io boolean option to send and receive data in a background thread, which also converts result values, so only table building and callbacks are run in the game thread (default: false)
 ---@field private conn PGconn native connection object (do not use it directly, otherwise be careful not to store it anywhere else, otherwise closing connection will be impossible)
----@field private queries { push: fun(self, q: PGQuery), prepend: fun(self, q: PGQuery), pop: (fun(self): PGQuery), size: fun(self): number } list of queries
+---@field private queries { push: fun(self, q: PGQuery), prepend: fun(self, q: PGQuery), pop: (fun(self): PGQuery), size: fun(self): number } list of queries waiting for connection
 ---@field package errorHandler function function that just calls self:onError(...)
 ---@field package acquired boolean
 ---@field package pool PGPool?
@@ -245,6 +490,9 @@ function Client:connect(callback)
             self.conn:setNoticeCallback(function(message, errdata)
                 xpcall(self.onNotice, self.errorHandler, self, message, errdata)
             end)
+            for channel, listener in pairs(self.listeners) do
+                self.conn:listen(channel, listener.callback, listener.coalesce)
+            end
 
             xpcall(callback, self.errorHandler, ok)
             self:processQueue()
@@ -285,17 +533,19 @@ end
 ---@private
 ---@param query PGQuery
 function Client:runQuery(query)
-    local array_result = self.array_result
-    if array_result then
-        self.conn:setArrayResult(true)
-    end
+    -- result options are captured by query when it is sent
+    local raw = query.raw == true
+    self.conn:setArrayResult(raw or self.array_result == true)
+    self.conn:setBinaryResult(raw or self.binary_result == true)
+    self.conn:setLazyResult(not raw and self.lazy_result == true)
+    self.conn:setColumnarResult(not raw and self.columnar_result == true)
+    self.conn:setTypedParams(not raw and self.typed_params == true, not raw and self.bytea_params == true)
+    self.conn:setPinnedParams(self.pinned_params or 0)
+    self.conn:setStatementCache(self.statement_cache or 0)
+    self.conn:setQueryTimeout(self.query_timeout or 0)
+    self.conn:setChunkSize(query.chunk_size or 0)
 
     local function callback(ok, result, errdata)
-        if array_result and not self.conn:querying() then
-            -- final query, reset array result
-            self.conn:setArrayResult(false)
-        end
-
         if not ok then
             local success, retry = xpcall(function() return self:onEnd() end, self.errorHandler)
             if success and retry then
@@ -313,6 +563,8 @@ function Client:runQuery(query)
         self.conn:query(query.query, callback)
     elseif query.command == "queryParams" then
         self.conn:queryParams(query.query, query.params, callback)
+    elseif query.command == "queryCached" then
+        self.conn:queryCached(query.query, query.params, query.ttl, query.tags, callback)
     elseif query.command == "prepare" then
         self.conn:prepare(query.name, query.query, callback)
     elseif query.command == "queryPrepared" then
@@ -321,20 +573,43 @@ function Client:runQuery(query)
         self.conn:describePrepared(query.name, callback)
     elseif query.command == "describePortal" then
         self.conn:describePortal(query.name, callback)
+    elseif query.command == "executeMany" then
+        self.conn:executeMany(query.query, query.params_list, callback)
+    elseif query.command == "executeManyPrepared" then
+        self.conn:executeManyPrepared(query.name, query.params_list, callback)
+    elseif query.command == "copyFrom" then
+        self.conn:copyFrom(query.query, query.source, callback)
+    elseif query.command == "copyToFile" then
+        self.conn:copyToFile(query.query, query.path, callback)
     end
 end
 
---- Processes queries in the queue
+--- Moves queries waiting for connection into the native connection queue
 ---@private
 function Client:processQueue()
-    if not self:connected() or self:isBusy() or self.queries:size() == 0 then
+    if not self:connected() or self.conn:resetting() then
         return
     end
 
-    local query = self.queries:pop()
-    local ok, err = pcall(self.runQuery, self, query)
-    if not ok then
-        xpcall(query.callback, self.errorHandler, false, err)
+    -- pipeline mode and threaded I/O can be changed only when connection is idle,
+    -- otherwise keep queries here until query callback will process queue again
+    local pipeline = self.pipeline == true
+    local threaded = self.threaded_io == true
+    if self.conn:getPipelineMode() ~= pipeline or self.conn:getThreadedIO() ~= threaded then
+        if self:isBusy() then
+            return
+        end
+
+        self.conn:setPipelineMode(pipeline)
+        self.conn:setThreadedIO(threaded)
+    end
+
+    while self.queries:size() ~= 0 do
+        local query = self.queries:pop()
+        local ok, err = pcall(self.runQuery, self, query)
+        if not ok then
+            xpcall(query.callback, self.errorHandler, false, err)
+        end
     end
 end
 
@@ -342,6 +617,8 @@ end
 ---
 --- It's recommended to use queryParams to prevent sql injections if you are going to pass parameters to a query.
 ---
+--- In pipeline mode query string must contain only one statement.
+---
 --- https://www.postgresql.org/docs/16/libpq-exec.html#LIBPQ-PQEXEC
 ---@see PGClient.queryParams to send a query with parameters
 ---@param query string
@@ -371,6 +648,210 @@ function Client:queryParams(query, params, callback)
     self:processQueue()
 end
 
+--- Sends a query with given parameters to the server,
+--- or returns its result from the result cache
+---
+--- Cache must be enabled with `async_postgres.setResultCacheSize(bytes)`,
+--- results are shared by all connections to the same database.
+--- On cache hit callback is called on the next tick, without a round trip.
+--- Result is removed after `ttl` milliseconds (0 means never),
+--- or when NOTIFY is received on any channel from `tags`,
+--- so writers can invalidate it with `NOTIFY tag` (client listens to tags automatically,
+--- such notifications are still passed to `onNotify`, and `unlisten` doesn't stop listening to them)
+--- ```lua
+--- client:queryCached("SELECT * FROM shop_items", {}, 60000, { "shop_items" }, function(ok, res) end)
+--- -- somewhere after shop items were changed
+--- client:query("NOTIFY shop_items")
+--- ```
+---@param query string
+---@param params PGAllowedParam[]
+---@param ttl number in milliseconds
+---@param tags string[]?
+---@param callback PGQueryCallback
+function Client:queryCached(query, params, ttl, tags, callback)
+    self.queries:push({
+        command = "queryCached",
+        query = query,
+        params = params,
+        ttl = ttl,
+        tags = tags,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Sends a query with given parameters to the server,
+--- and delivers rows to the callback in chunks of given size
+---
+--- Callback is called with `result.partial = true` for every chunk of rows,
+--- and then once more with final result (which may contain no rows),
+--- in pipeline mode rows might be delivered with final result
+---
+--- https://www.postgresql.org/docs/16/libpq-single-row-mode.html
+---@param query string
+---@param params PGAllowedParam[]
+---@param chunkSize number
+---@param callback PGQueryCallback
+function Client:queryStream(query, params, chunkSize, callback)
+    self.queries:push({
+        command = "queryParams",
+        query = query,
+        params = params,
+        chunk_size = chunkSize,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Executes one statement with every given params array,
+--- all executions are sent at once and followed by a single sync
+---
+--- SQL is prepared once for all executions, use `executeManyPrepared` for existing prepared statement.
+--- Executions run in one implicit transaction (unless transaction is already open),
+--- so if one fails, none are applied and `errdata.index` is the index of failed params array
+---
+--- Callback is called once with total number of affected rows
+---
+--- Not supported with threaded I/O
+---@param query string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Client:executeMany(query, paramsList, callback)
+    if self.threaded_io then
+        error("executeMany is not supported with threaded I/O")
+    end
+
+    self.queries:push({
+        command = "executeMany",
+        query = query,
+        params_list = paramsList,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Same as `executeMany`, but executes prepared statement with given name
+---@see PGClient.executeMany
+---@param name string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Client:executeManyPrepared(name, paramsList, callback)
+    if self.threaded_io then
+        error("executeMany is not supported with threaded I/O")
+    end
+
+    self.queries:push({
+        command = "executeManyPrepared",
+        name = name,
+        params_list = paramsList,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Loads rows into a table with `COPY ... FROM STDIN`,
+--- which is much faster than inserting rows one by one
+---
+--- Source is either an array of rows, or a function which returns next row
+--- (or nil when there are no more rows), every row is an array of column values.
+--- Rows are encoded in text format and sent in batches over multiple ticks,
+--- if source errors or contains unsupported value, COPY is aborted
+---
+--- Not supported in pipeline mode and with threaded I/O
+---
+--- https://www.postgresql.org/docs/16/sql-copy.html
+---@param query string e.g. `COPY events (steamid, action) FROM STDIN`
+---@param source PGCopySource
+---@param callback PGQueryCallback
+function Client:copyFrom(query, source, callback)
+    if self.pipeline or self.threaded_io then
+        error("copyFrom is not supported in pipeline mode or with threaded I/O")
+    end
+
+    self.queries:push({
+        command = "copyFrom",
+        query = query,
+        source = source,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Runs `COPY ... TO STDOUT` and writes received data straight into a file,
+--- rows never reach lua, callback only receives number of written rows and bytes
+---
+--- Path is relative to the `garrysmod/data/` directory, directory must exist,
+--- and file must have one of extensions allowed by `file.Write` (e.g. `.csv`, `.txt`, `.json`).
+--- File is created (or truncated) when the server starts sending data
+---
+--- Not supported in pipeline mode and with threaded I/O
+---
+--- https://www.postgresql.org/docs/16/sql-copy.html
+---@param query string e.g. `COPY players TO STDOUT WITH (FORMAT csv, HEADER)`
+---@param path string e.g. `exports/players.csv`
+---@param callback fun(ok: boolean, result: PGCopyResult|string)
+function Client:copyToFile(query, path, callback)
+    if self.pipeline or self.threaded_io then
+        error("copyToFile is not supported in pipeline mode or with threaded I/O")
+    end
+
+    self.queries:push({
+        command = "copyToFile",
+        query = query,
+        path = path,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Sends a query with parameters, which receives raw values
+--- regardless of client result options
+---@package
+---@param query string
+---@param params PGAllowedParam[]
+---@param callback PGQueryCallback
+function Client:queryRaw(query, params, callback)
+    self.queries:push({
+        command = "queryParams",
+        query = query,
+        params = params,
+        raw = true,
+        callback = callback,
+    })
+    self:processQueue()
+end
+
+--- Opens existing large object for reading and writing
+---
+--- Large objects are accessed with server-side `lo_get`/`lo_put` functions,
+--- so they don't need to be opened inside a transaction,
+--- and opening only checks that object exists and can be read
+---
+--- https://www.postgresql.org/docs/16/lo-funcs.html
+---@param oid number
+---@param callback fun(ok: boolean, lo: PGLargeObject|string)
+function Client:openLargeObject(oid, callback)
+    self:queryRaw("SELECT pg_catalog.lo_get($1::oid, 0, 0)", { oid }, function(ok, result)
+        if not ok then
+            return callback(false, result)
+        end
+        return callback(true, setmetatable({ client = self, oid = oid, position = 0 }, LargeObject))
+    end)
+end
+
+--- Creates a new empty large object and opens it
+---@param callback fun(ok: boolean, lo: PGLargeObject|string)
+function Client:createLargeObject(callback)
+    self:queryRaw("SELECT pg_catalog.lo_create(0)", {}, function(ok, result)
+        if not ok then
+            return callback(false, result)
+        end
+
+        local oid = result.rows[1][1]
+        return callback(true, setmetatable({ client = self, oid = oid, position = 0 }, LargeObject))
+    end)
+end
+
 --- Sends a request to create prepared statement,
 --- unnamed prepared statement will replace any existing unnamed prepared statement
 ---
@@ -467,6 +948,10 @@ function Client:close(wait)
         end
     end
 
+    if self.conn then
+        self.conn:clearQueries("connection to the database was closed")
+    end
+
     self.queries = Queue.new()
     self.conn = nil
     self.closed = true
@@ -479,7 +964,29 @@ end
 ---@see PGClient.isBusy to check if any query currently executing
 ---@return number
 function Client:pendingQueries()
-    return self.queries:size()
+    return self.queries:size() + (self.conn and self.conn:pendingQueries() or 0)
+end
+
+--- Returns number of queued queries together with ones which were sent
+--- and haven't finished yet (in pipeline mode there might be many of them)
+---@return number
+function Client:outstandingQueries()
+    return self.queries:size() + (self.conn and self.conn:outstandingQueries() or 0)
+end
+
+--- Asks the server to cancel currently running query,
+--- which then fails with an error (unless it finishes first)
+---
+--- Request is sent from a background thread, so this function doesn't block
+---@return boolean requested false if no query is running
+function Client:cancel()
+    return self.conn ~= nil and self.conn:cancel()
+end
+
+--- Returns metrics of the connection, or nil if client is not connected
+---@return PGStats?
+function Client:stats()
+    return self.conn and self.conn:stats()
 end
 
 --- Returns the database name of the connection.
@@ -655,6 +1162,36 @@ function Client:release(suppress)
     pool:processQueue() -- after client was release, we need to process pool queue
 end
 
+--- Listens to the channel and calls callback once per tick
+--- with all payloads which were received in the channel
+---
+--- Notifications of listened channels are not passed to `Client:onNotify`.
+--- With `coalesce = true` same payloads received in one tick are delivered once
+---
+--- https://www.postgresql.org/docs/16/sql-listen.html
+---@param channel string
+---@param callback fun(channel: string, payloads: string[])
+---@param coalesce boolean?
+function Client:listen(channel, callback, coalesce)
+    local function wrapped(...)
+        xpcall(callback, self.errorHandler, ...)
+    end
+
+    self.listeners[channel] = { callback = wrapped, coalesce = coalesce == true }
+    if self.conn then
+        self.conn:listen(channel, wrapped, coalesce == true)
+    end
+end
+
+--- Stops listening to the channel
+---@param channel string
+function Client:unlisten(channel)
+    self.listeners[channel] = nil
+    if self.conn then
+        self.conn:unlisten(channel)
+    end
+end
+
 --- This **event** function is called when NOTIFY message is received
 ---
 --- You can set it to your own function to handle NOTIFY messages
@@ -714,6 +1251,7 @@ function async_postgres.Client(url)
         url = url,
         connecting = false,
         queries = Queue.new(),
+        listeners = {},
     }, Client)
 
     client.errorHandler = function(...) return client:onError(...) end
@@ -771,6 +1309,28 @@ function TransactionContext:queryParams(query, params)
     end)
 end
 
+--- Executes one statement with every given params array
+---@see PGClient.executeMany
+---@async
+---@param query string
+---@param paramsList PGAllowedParam[][]
+function TransactionContext:executeMany(query, paramsList)
+    return async(function(callback)
+        self.client:executeMany(query, paramsList, callback)
+    end)
+end
+
+--- Executes prepared statement with every given params array
+---@see PGClient.executeManyPrepared
+---@async
+---@param name string
+---@param paramsList PGAllowedParam[][]
+function TransactionContext:executeManyPrepared(name, paramsList)
+    return async(function(callback)
+        self.client:executeManyPrepared(name, paramsList, callback)
+    end)
+end
+
 --- Sends a request to create prepared statement
 ---@see PGClient.prepare
 ---@async
@@ -967,6 +1527,97 @@ function Pool:queryParams(query, params, callback)
     end)
 end
 
+--- Sends a query with given parameters to the server,
+--- or returns its result from the result cache
+---@see PGClient.queryCached
+---@param query string
+---@param params PGAllowedParam[]
+---@param ttl number in milliseconds
+---@param tags string[]?
+---@param callback PGQueryCallback
+function Pool:queryCached(query, params, ttl, tags, callback)
+    return self:connect(function(client)
+        return client:queryCached(query, params, ttl, tags, function(...)
+            client:release()
+            return callback(...)
+        end)
+    end)
+end
+
+--- Sends a query with given parameters to the server,
+--- and delivers rows to the callback in chunks
+---@see PGClient.queryStream
+---@param query string
+---@param params PGAllowedParam[]
+---@param chunkSize number
+---@param callback PGQueryCallback
+function Pool:queryStream(query, params, chunkSize, callback)
+    return self:connect(function(client)
+        return client:queryStream(query, params, chunkSize, function(ok, res, ...)
+            if not ok or not res.partial then
+                client:release()
+            end
+            return callback(ok, res, ...)
+        end)
+    end)
+end
+
+--- Executes one statement with every given params array
+---@see PGClient.executeMany
+---@param query string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Pool:executeMany(query, paramsList, callback)
+    return self:connect(function(client)
+        return client:executeMany(query, paramsList, function(...)
+            client:release()
+            return callback(...)
+        end)
+    end)
+end
+
+--- Executes prepared statement with every given params array
+---@see PGClient.executeManyPrepared
+---@param name string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Pool:executeManyPrepared(name, paramsList, callback)
+    return self:connect(function(client)
+        return client:executeManyPrepared(name, paramsList, function(...)
+            client:release()
+            return callback(...)
+        end)
+    end)
+end
+
+--- Loads rows into a table with `COPY ... FROM STDIN`
+---@see PGClient.copyFrom
+---@param query string
+---@param source PGCopySource
+---@param callback PGQueryCallback
+function Pool:copyFrom(query, source, callback)
+    return self:connect(function(client)
+        return client:copyFrom(query, source, function(...)
+            client:release()
+            return callback(...)
+        end)
+    end)
+end
+
+--- Runs `COPY ... TO STDOUT` and writes received data into a file
+---@see PGClient.copyToFile
+---@param query string
+---@param path string
+---@param callback fun(ok: boolean, result: PGCopyResult|string)
+function Pool:copyToFile(query, path, callback)
+    return self:connect(function(client)
+        return client:copyToFile(query, path, function(...)
+            client:release()
+            return callback(...)
+        end)
+    end)
+end
+
 --- Sends a request to create prepared statement
 ---@see PGClient.prepare
 ---@param name string
@@ -1045,7 +1696,7 @@ end
 --- at the end transaction will be commited,
 --- if any error will be thrown, transaction will be rolled back
 ---
---- TransactionContext passed into callback has `query`, `queryParams`, `prepare`, `queryPrepared`, `describePrepared`, `describePortal` methods
+--- TransactionContext passed into callback has `query`, `queryParams`, `executeMany`, `executeManyPrepared`, `prepare`, `queryPrepared`, `describePrepared`, `describePortal` methods
 --- ```lua
 --- pool:transaction(function(ctx)
 ---     local oid = ctx:queryParams("INSERT INTO players (name, id) VALUES ($1, $2)", { "Player", 1234 }).oid
@@ -1062,10 +1713,59 @@ function Pool:transaction(callback)
     end)
 end
 
+--- Waits until connections of given clients finish their queries,
+--- queries queued in clients are sent before every wait,
+--- since finished queries might let them through
+---@param clients PGClient[]
+---@param timeout number? in milliseconds, waits without limit if not given
+---@return boolean finished false if timeout has passed
+local function waitClients(clients, timeout)
+    local deadline = timeout and SysTime() + timeout / 1000
+    while true do
+        local conns = {}
+        for _, client in ipairs(clients) do
+            if client.conn then
+                client:processQueue()
+                conns[#conns + 1] = client.conn
+            end
+        end
+
+        local left = deadline and math.max(deadline - SysTime(), 0) * 1000
+        if not async_postgres.waitAll(conns, left) then
+            return false
+        end
+
+        -- queries which are left can't be sent until client reconnects
+        local queued = false
+        for _, client in ipairs(clients) do
+            if client:connected() and client.queries:size() ~= 0 then
+                queued = true
+                break
+            end
+        end
+
+        if not queued then
+            return true
+        end
+    end
+end
+
+--- Waits until all clients of the pool finish their queries,
+--- sockets of all clients are waited together
+---@param timeout number? in milliseconds, waits without limit if not given
+---@return boolean finished false if timeout has passed
+function Pool:wait(timeout)
+    return waitClients(self.clients, timeout)
+end
+
 --- Closes the pool and all clients in it
 --- If `wait = true`, will wait until all queries are processed
 ---@param wait boolean?
 function Pool:close(wait)
+    if wait then
+        self:wait()
+    end
+
     for _, client in ipairs(self.clients) do
         client:close(wait)
     end
@@ -1126,4 +1826,315 @@ function async_postgres.Pool(url)
     return pool
 end
 
+---@class PGRouter
+---@field writer PGClient **readonly** client connected to the primary, used for writes
+---@field readers PGClient[] **readonly** clients connected to the replicas
+---@field closed boolean **readonly** is router closed
+---@field private lsn number WAL position of the last write, reads must see it
+---@field private replayed table<PGClient, number> last known replay position of replicas
+---@field private refreshing table<PGClient, boolean> replicas which are being asked for replay position
+---@field private errorHandler function function that just calls self:onError(...)
+local Router = {}
+
+---@private
+Router.__index = Router
+
+---@private
+function Router:__tostring()
+    return string.format("PGRouter<%s (%d readers)>", tostring(self.writer), #self.readers)
+end
+
+-- statements which are safe to run on a replica,
+-- anything that might write or lock rows goes to the writer
+local READ_KEYWORDS = { select = true, with = true, show = true, table = true, values = true }
+local WRITE_PATTERNS = {
+    "%f[%a]insert%f[%A]", "%f[%a]update%f[%A]", "%f[%a]delete%f[%A]",
+    "%f[%a]merge%f[%A]", "%f[%a]into%f[%A]", "%f[%a]lock%f[%A]",
+    "%f[%a]share%f[%A]", "%f[%a]nextval%f[%A]", "%f[%a]setval%f[%A]",
+}
+
+---@param query string
+---@return boolean
+local function isReadQuery(query)
+    local sql = query:lower()
+    if not READ_KEYWORDS[sql:match("^%s*(%a+)")] then
+        return false
+    end
+
+    for _, pattern in ipairs(WRITE_PATTERNS) do
+        if sql:find(pattern) then
+            return false
+        end
+    end
+    return true
+end
+
+-- LSN is formatted as two hex numbers, e.g. 16/B374D848
+---@param lsn string?
+---@return number?
+local function parseLSN(lsn)
+    local hi, lo = (lsn or ""):match("^(%x+)/(%x+)$")
+    if hi then
+        return tonumber(hi, 16) * 4294967296 + tonumber(lo, 16)
+    end
+end
+
+---@param result PGResult
+---@return string?
+local function firstValue(result)
+    if result.columns then
+        local column = result.columns.lsn or result.columns[1]
+        return column and column[1]
+    end
+
+    local row = result.rows and result.rows[1]
+    return row and (row.lsn or row[1])
+end
+
+--- Asks the replica how far it has replayed WAL, if it's not asked already
+---@private
+---@param client PGClient
+function Router:refreshReplica(client)
+    if self.refreshing[client] then
+        return
+    end
+
+    self.refreshing[client] = true
+    client:query("SELECT pg_last_wal_replay_lsn()::text AS lsn", function(ok, result)
+        self.refreshing[client] = nil
+        if ok then
+            ---@cast result PGResult
+            self.replayed[client] = parseLSN(firstValue(result))
+        end
+    end)
+end
+
+--- Returns replica with the least outstanding queries,
+--- which has replayed the last write, or nil if there is none
+---@private
+---@return PGClient?
+function Router:pickReader()
+    local best, bestOutstanding
+    for _, client in ipairs(self.readers) do
+        if client:connected() then
+            if self.lsn == 0 or (self.replayed[client] or -1) >= self.lsn then
+                local outstanding = client:outstandingQueries()
+                if not best or outstanding < bestOutstanding then
+                    best, bestOutstanding = client, outstanding
+                end
+            else
+                -- lagging replica will be used again once it catches up
+                self:refreshReplica(client)
+            end
+        end
+    end
+    return best
+end
+
+---@private
+---@param send fun(client: PGClient)
+function Router:sendRead(send)
+    send(self:pickReader() or self.writer)
+end
+
+--- Sends write to the writer followed by `pg_current_wal_lsn()`,
+--- callback is called after WAL position of the write is known,
+--- so reads made from the callback already see the write
+---@private
+---@param send fun(client: PGClient, callback: function)
+---@param callback function
+function Router:sendWrite(send, callback)
+    local args
+    send(self.writer, function(...)
+        args = { n = select("#", ...), ... }
+    end)
+
+    self.writer:query("SELECT pg_current_wal_lsn()::text AS lsn", function(ok, result)
+        if ok then
+            ---@cast result PGResult
+            local lsn = parseLSN(firstValue(result))
+            if lsn and lsn > self.lsn then
+                self.lsn = lsn
+            end
+        end
+
+        if args then
+            return callback(unpack(args, 1, args.n))
+        end
+        return callback(false, ok and "write query was not completed" or result)
+    end)
+end
+
+--- Connects the writer and all readers,
+--- callback is called when the writer is connected
+---
+--- Replicas which failed to connect are skipped until they are connected again
+---@param callback fun(ok: boolean, err: string?)
+function Router:connect(callback)
+    if self.closed then
+        error("router was closed")
+    end
+
+    for _, client in ipairs(self.readers) do
+        if not client:connected() and not client.connecting then
+            client:connect(function(ok, err)
+                if not ok then
+                    self:onError("PGRouter - failed to connect to the replica: " .. err, client)
+                end
+            end)
+        end
+    end
+
+    if self.writer:connected() then
+        callback(true)
+    else
+        self.writer:connect(callback)
+    end
+end
+
+--- Sends a query, read-only statements (`SELECT`/`WITH`/`SHOW`/`TABLE`/`VALUES`
+--- which don't lock or modify rows) are sent to a replica, others to the writer
+---@see PGClient.query
+---@param query string
+---@param callback PGQueryCallback
+function Router:query(query, callback)
+    if isReadQuery(query) then
+        return self:sendRead(function(client)
+            client:query(query, callback)
+        end)
+    end
+
+    return self:sendWrite(function(client, cb)
+        client:query(query, cb)
+    end, callback)
+end
+
+--- Sends a query with parameters, routed same as `Router:query`
+---@see PGClient.queryParams
+---@param query string
+---@param params PGAllowedParam[]
+---@param callback PGQueryCallback
+function Router:queryParams(query, params, callback)
+    if isReadQuery(query) then
+        return self:sendRead(function(client)
+            client:queryParams(query, params, callback)
+        end)
+    end
+
+    return self:sendWrite(function(client, cb)
+        client:queryParams(query, params, cb)
+    end, callback)
+end
+
+--- Sends a query to a replica without checking the statement,
+--- use it for reads which can't be detected, e.g. calls of read-only functions
+---
+--- Statement must not modify anything, replicas will reject it anyway
+---@param query string
+---@param params PGAllowedParam[]?
+---@param callback PGQueryCallback
+function Router:readOnly(query, params, callback)
+    return self:sendRead(function(client)
+        client:queryParams(query, params or {}, callback)
+    end)
+end
+
+--- Executes one statement with every given params array on the writer
+---@see PGClient.executeMany
+---@param query string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Router:executeMany(query, paramsList, callback)
+    return self:sendWrite(function(client, cb)
+        client:executeMany(query, paramsList, cb)
+    end, callback)
+end
+
+--- Executes prepared statement with every given params array on the writer
+---@see PGClient.executeManyPrepared
+---@param name string
+---@param paramsList PGAllowedParam[][]
+---@param callback fun(ok: boolean, result: PGExecuteManyResult|string, errdata: table?)
+function Router:executeManyPrepared(name, paramsList, callback)
+    return self:sendWrite(function(client, cb)
+        client:executeManyPrepared(name, paramsList, cb)
+    end, callback)
+end
+
+--- Waits until the writer and all readers finish their queries
+---@param timeout number? in milliseconds, waits without limit if not given
+---@return boolean finished false if timeout has passed
+function Router:wait(timeout)
+    return waitClients({ self.writer, unpack(self.readers) }, timeout)
+end
+
+--- Closes the writer and all readers
+--- If `wait = true`, will wait until all queries are processed
+---@param wait boolean?
+function Router:close(wait)
+    if wait then
+        self:wait()
+    end
+
+    self.writer:close(wait)
+    for _, client in ipairs(self.readers) do
+        client:close(wait)
+    end
+    self.closed = true
+end
+
+--- This **event** function is called whenever an error occurs inside query callback of any client.
+---@param message string error message
+---@param client PGClient? client that caused the error
+function Router:onError(message, client)
+    return ErrorNoHaltWithStack(message)
+end
+
+--- Creates a router which sends writes to the primary and reads to the replicas
+---
+--- Reads go to the connected replica with the least outstanding queries,
+--- which has replayed the last write made through the router.
+--- If no replica has caught up yet, read is sent to the writer
+--- ```lua
+--- local router = async_postgres.Router("postgresql://primary/db", {
+---     "postgresql://replica1/db",
+---     "postgresql://replica2/db",
+--- })
+---
+--- router:connect(function(ok, err)
+---     router:queryParams("UPDATE players SET name = $1 WHERE id = $2", { "Player", 1234 }, function()
+---         -- replica is used only if it has already replayed the update
+---         router:queryParams("SELECT name FROM players WHERE id = $1", { 1234 }, PrintTable)
+---     end)
+--- end)
+--- ```
+---@param writerUrl string
+---@param readerUrls string[]
+---@return PGRouter
+function async_postgres.Router(writerUrl, readerUrls)
+    ---@class PGRouter
+    local router = setmetatable({
+        writer = async_postgres.Client(writerUrl),
+        readers = {},
+        lsn = 0,
+        replayed = {},
+        refreshing = {},
+    }, Router)
+
+    local function onError(client, message)
+        return router:onError(message, client)
+    end
+
+    router.writer.onError = onError
+    for i, url in ipairs(readerUrls) do
+        local client = async_postgres.Client(url)
+        client.onError = onError
+        router.readers[i] = client
+    end
+
+    router.errorHandler = function(...) return router:onError(...) end
+
+    return router
+end
+
 return module
@@ -0,0 +1,253 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "async_postgres.hpp"
+#include "lua_stub.hpp"
+
+using namespace async_postgres;
+using namespace async_postgres::bench;
+
+using Clock = std::chrono::steady_clock;
+
+// Oids are taken from catalog/pg_type_d.h
+constexpr Oid INT8OID = 20;
+constexpr Oid TEXTOID = 25;
+constexpr Oid FLOAT8OID = 701;
+
+// every case runs at least this long, can be changed by first argument
+double min_seconds = 1.0;
+
+// calls fn repeatedly and returns how many times per second it was called
+template <typename Fn>
+double measure(Fn&& fn) {
+    for (int i = 0; i < 3; i++) {
+        fn();
+    }
+
+    size_t iterations = 0;
+    double elapsed = 0;
+    auto start = Clock::now();
+    do {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    return iterations / elapsed;
+}
+
+void report(const std::string& name, double per_second, size_t rows,
+            size_t bytes) {
+    std::printf("%-52s %14.0f rows/s %10.1f MiB/s\n", name.c_str(),
+                per_second * rows, per_second * bytes / (1024 * 1024));
+}
+
+inline std::string write_be(std::uint64_t value) {
+    std::string result(8, '\0');
+    for (int i = 7; i >= 0; i--) {
+        result[i] = static_cast<char>(value & 0xFF);
+        value >>= 8;
+    }
+    return result;
+}
+
+struct ResultCase {
+    const char* name;
+    int rows;
+    int columns;
+    Oid type;
+    // 0 is text, 1 is binary
+    int format;
+    // size of text values, binary values have size of their type
+    size_t value_size;
+};
+
+const ResultCase result_cases[] = {
+    {"text", 1, 4, TEXTOID, 0, 16},
+    {"text", 100, 4, TEXTOID, 0, 16},
+    {"text", 10000, 4, TEXTOID, 0, 16},
+    {"text", 1000, 16, TEXTOID, 0, 16},
+    {"text", 1000, 4, TEXTOID, 0, 1024},
+    {"int8", 10000, 4, INT8OID, 1, 8},
+    {"float8", 10000, 4, FLOAT8OID, 1, 8},
+};
+
+inline std::string make_value(const ResultCase& test, int row) {
+    if (test.format == 0) {
+        return std::string(test.value_size, 'a' + row % 26);
+    }
+
+    if (test.type == FLOAT8OID) {
+        double number = row + 0.5;
+        std::uint64_t bits = 0;
+        std::memcpy(&bits, &number, sizeof(number));
+        return write_be(bits);
+    }
+    return write_be(row);
+}
+
+// builds result which looks like one received from the server
+pg::result make_result(const ResultCase& test) {
+    pg::result result(PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK),
+                      &PQclear);
+    if (!result) {
+        throw std::runtime_error("failed to create PGresult");
+    }
+
+    std::vector<std::string> names;
+    for (int i = 0; i < test.columns; i++) {
+        names.push_back("column" + std::to_string(i + 1));
+    }
+
+    std::vector<PGresAttDesc> attributes(test.columns);
+    for (int i = 0; i < test.columns; i++) {
+        auto& attribute = attributes[i];
+        attribute.name = names[i].data();
+        attribute.format = test.format;
+        attribute.typid = test.type;
+        attribute.typlen = test.format == 0 ? -1 : 8;
+        attribute.atttypmod = -1;
+    }
+
+    if (!PQsetResultAttrs(result.get(), test.columns, attributes.data())) {
+        throw std::runtime_error("failed to set PGresult attributes");
+    }
+
+    for (int row = 0; row < test.rows; row++) {
+        auto value = make_value(test, row);
+        for (int column = 0; column < test.columns; column++) {
+            if (!PQsetvalue(result.get(), row, column, value.data(),
+                            value.size())) {
+                throw std::runtime_error("failed to set PGresult value");
+            }
+        }
+    }
+
+    return result;
+}
+
+void bench_result(GLua::ILuaInterface* lua, const ResultCase& test) {
+    auto result = make_result(test);
+    size_t bytes = 0;
+    for (int row = 0; row < test.rows; row++) {
+        for (int column = 0; column < test.columns; column++) {
+            bytes += PQgetlength(result.get(), row, column);
+        }
+    }
+
+    struct Mode {
+        const char* name;
+        bool array;
+        bool columnar;
+    };
+    const Mode modes[] = {
+        {"keyed", false, false},
+        {"array", true, false},
+        {"columnar", false, true},
+    };
+
+    for (const auto& mode : modes) {
+        collect_garbage(lua);
+        double per_second = measure([&] {
+            create_result_table(lua, result.get(), mode.array, mode.columnar);
+            lua->Pop();
+        });
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "create_result_table %s %s %dx%d/%zu",
+                      mode.name, test.name, test.rows, test.columns,
+                      test.value_size);
+        report(name, per_second, test.rows, bytes);
+    }
+}
+
+struct ParamsCase {
+    const char* name;
+    int count;
+    // 0 means that numbers are used instead of strings
+    size_t string_size;
+};
+
+const ParamsCase params_cases[] = {
+    {"string", 4, 16},
+    {"string", 16, 16},
+    {"string", 4, 4096},
+    {"number", 4, 0},
+    {"number", 16, 0},
+};
+
+// pushes params array onto the stack
+void push_params(GLua::ILuaInterface* lua, const ParamsCase& test) {
+    lua->CreateTable();
+    for (int i = 0; i < test.count; i++) {
+        lua->PushNumber(i + 1);
+        if (test.string_size > 0) {
+            std::string value(test.string_size, 'a' + i % 26);
+            lua->PushString(value.data(), value.size());
+        } else {
+            lua->PushNumber(i * 1000 + 0.25 * (i % 2));
+        }
+        lua->SetTable(-3);
+    }
+}
+
+// params are counted as rows, since every params array is one execution
+void bench_params(GLua::ILuaInterface* lua, const ParamsCase& test) {
+    struct Mode {
+        const char* name;
+        ParamOptions options;
+    };
+    const Mode modes[] = {
+        {"text", ParamOptions{}},
+        {"typed", ParamOptions{true, true, true}},
+    };
+
+    push_params(lua, test);
+    int index = lua->Top();
+
+    for (const auto& mode : modes) {
+        // params are reused like queued queries reuse them
+        ParamValues param;
+        array_to_params(lua, index, mode.options, param);
+        size_t bytes = param.arena.size();
+
+        collect_garbage(lua);
+        double per_second = measure(
+            [&] { array_to_params(lua, index, mode.options, param); });
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "array_to_params %s %s %dx%zu",
+                      mode.name, test.name, test.count, test.string_size);
+        report(name, per_second, 1, bytes);
+    }
+
+    lua->Pop();
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        min_seconds = std::atof(argv[1]);
+    }
+
+    auto lua = create_lua_interface();
+    try {
+        for (const auto& test : result_cases) {
+            bench_result(lua, test);
+        }
+        for (const auto& test : params_cases) {
+            bench_params(lua, test);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "benchmark failed: %s\n", e.what());
+        close_lua_interface(lua);
+        return 1;
+    }
+
+    close_lua_interface(lua);
+    return 0;
+}
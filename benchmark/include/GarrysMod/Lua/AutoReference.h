@@ -0,0 +1,55 @@
+#pragma once
+#include "Interface.h"
+
+namespace GarrysMod::Lua {
+    // same semantics as garrysmod_common's AutoReference
+    class AutoReference {
+       public:
+        AutoReference() = default;
+
+        AutoReference(ILuaBase* lua, int iStackPos = -1) : lua(lua) {
+            lua->Push(iStackPos);
+            ref = lua->ReferenceCreate();
+        }
+
+        AutoReference(const AutoReference&) = delete;
+        AutoReference(AutoReference&& other) noexcept
+            : lua(other.lua), ref(other.ref) {
+            other.ref = -1;
+        }
+
+        AutoReference& operator=(AutoReference&& other) noexcept {
+            if (this != &other) {
+                Free();
+                lua = other.lua;
+                ref = other.ref;
+                other.ref = -1;
+            }
+            return *this;
+        }
+
+        ~AutoReference() { Free(); }
+
+        bool IsValid() const { return lua && ref != -1; }
+        explicit operator bool() const { return IsValid(); }
+
+        void Free() {
+            if (IsValid()) {
+                lua->ReferenceFree(ref);
+            }
+            ref = -1;
+        }
+
+        bool Push() const {
+            if (!IsValid()) {
+                return false;
+            }
+            lua->ReferencePush(ref);
+            return true;
+        }
+
+       private:
+        ILuaBase* lua = nullptr;
+        int ref = -1;
+    };
+}  // namespace GarrysMod::Lua
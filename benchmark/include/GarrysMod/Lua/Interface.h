@@ -0,0 +1,100 @@
+#pragma once
+// Minimal stand-in for garrysmod_common's Interface.h, which is used only
+// by benchmarks. It declares just the part of ILuaBase which is used by
+// result.cpp and util.cpp, methods are implemented by lua_stub.cpp on top of
+// stock LuaJIT. Functions are not virtual, so this must never be linked into
+// the module itself.
+
+struct lua_State;
+
+namespace GarrysMod::Lua {
+    class ILuaBase;
+
+    namespace Type {
+        enum {
+            None = -1,
+            Nil,
+            Bool,
+            LightUserData,
+            Number,
+            String,
+            Table,
+            Function,
+            UserData,
+            Thread,
+        };
+    }
+
+    enum { INDEX_REGISTRY = -10000, INDEX_GLOBAL = -10002 };
+
+    typedef int (*CFunc)(lua_State* L);
+
+    class ILuaBase {
+       public:
+        explicit ILuaBase(lua_State* state) : state(state) {}
+
+        int Top();
+        void Push(int iStackPos);
+        void Pop(int iAmt = 1);
+        void GetTable(int iStackPos);
+        void GetField(int iStackPos, const char* strName);
+        void SetField(int iStackPos, const char* strName);
+        void CreateTable();
+        void SetTable(int iStackPos);
+        void SetMetaTable(int iStackPos);
+        void Call(int iArgs, int iResults);
+        int PCall(int iArgs, int iResults, int iErrorFunc);
+        void Insert(int iStackPos);
+        void Remove(int iStackPos);
+        int Next(int iStackPos);
+        void ThrowError(const char* strError);
+        void CheckType(int iStackPos, int iType);
+        void RawGet(int iStackPos);
+        void RawSet(int iStackPos);
+        int ObjLen(int iStackPos = -1);
+
+        const char* GetString(int iStackPos = -1,
+                              unsigned int* iOutLen = nullptr);
+        double GetNumber(int iStackPos = -1);
+        bool GetBool(int iStackPos = -1);
+
+        void PushNil();
+        void PushString(const char* val, unsigned int iLen = 0);
+        void PushNumber(double val);
+        void PushBool(bool val);
+        void PushCFunction(CFunc val);
+
+        int ReferenceCreate();
+        void ReferenceFree(int i);
+        void ReferencePush(int i);
+
+        bool IsType(int iStackPos, int iType);
+        int GetType(int iStackPos);
+        const char* GetTypeName(int iType);
+
+        int CreateMetaTable(const char* strName);
+        bool PushMetaTable(int iType);
+        void PushUserType(void* data, int iType);
+        void SetUserType(int iStackPos, void* data);
+
+        template <class T>
+        T* GetUserType(int iStackPos, int iType) {
+            return static_cast<T*>(GetUserTypeData(iStackPos, iType));
+        }
+
+        void SetState(lua_State* L) {}
+        // not a part of Garry's Mod interface
+        lua_State* GetState() const { return state; }
+
+       protected:
+        void* GetUserTypeData(int iStackPos, int iType);
+
+        lua_State* state;
+    };
+}  // namespace GarrysMod::Lua
+
+// LuaJIT's lua_State is opaque, so luabase is only a placeholder
+// for lua_protected_fn, which is not called by benchmarks
+struct lua_State {
+    GarrysMod::Lua::ILuaBase* luabase;
+};
@@ -0,0 +1,11 @@
+#pragma once
+#include "Interface.h"
+
+namespace GarrysMod::Lua {
+    class ILuaInterface : public ILuaBase {
+       public:
+        using ILuaBase::ILuaBase;
+
+        void Msg(const char* fmt, ...);
+    };
+}  // namespace GarrysMod::Lua
@@ -0,0 +1,9 @@
+#pragma once
+
+#if defined(_WIN32)
+#define SYSTEM_IS_WINDOWS 1
+#elif defined(__APPLE__)
+#define SYSTEM_IS_MACOSX 1
+#elif defined(__linux__)
+#define SYSTEM_IS_LINUX 1
+#endif
@@ -0,0 +1,204 @@
+#include <lua.hpp>
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lua_stub.hpp"
+
+using namespace GarrysMod::Lua;
+
+// types created by CreateMetaTable are numbered after builtin ones
+constexpr int FIRST_USER_TYPE = 255;
+
+// userdata layout of types pushed by PushUserType
+struct UserData {
+    void* data;
+    int type;
+};
+
+std::vector<std::string> user_types;
+
+int ILuaBase::Top() { return lua_gettop(state); }
+
+void ILuaBase::Push(int iStackPos) { lua_pushvalue(state, iStackPos); }
+
+void ILuaBase::Pop(int iAmt) { lua_pop(state, iAmt); }
+
+void ILuaBase::GetTable(int iStackPos) { lua_gettable(state, iStackPos); }
+
+void ILuaBase::GetField(int iStackPos, const char* strName) {
+    lua_getfield(state, iStackPos, strName);
+}
+
+void ILuaBase::SetField(int iStackPos, const char* strName) {
+    lua_setfield(state, iStackPos, strName);
+}
+
+void ILuaBase::CreateTable() { lua_createtable(state, 0, 0); }
+
+void ILuaBase::SetTable(int iStackPos) { lua_settable(state, iStackPos); }
+
+void ILuaBase::SetMetaTable(int iStackPos) {
+    lua_setmetatable(state, iStackPos);
+}
+
+void ILuaBase::Call(int iArgs, int iResults) {
+    lua_call(state, iArgs, iResults);
+}
+
+int ILuaBase::PCall(int iArgs, int iResults, int iErrorFunc) {
+    return lua_pcall(state, iArgs, iResults, iErrorFunc);
+}
+
+void ILuaBase::Insert(int iStackPos) { lua_insert(state, iStackPos); }
+
+void ILuaBase::Remove(int iStackPos) { lua_remove(state, iStackPos); }
+
+int ILuaBase::Next(int iStackPos) { return lua_next(state, iStackPos); }
+
+void ILuaBase::ThrowError(const char* strError) {
+    luaL_error(state, "%s", strError);
+}
+
+void ILuaBase::CheckType(int iStackPos, int iType) {
+    if (!IsType(iStackPos, iType)) {
+        luaL_error(state, "bad argument #%d (%s expected, got %s)", iStackPos,
+                   GetTypeName(iType), GetTypeName(GetType(iStackPos)));
+    }
+}
+
+void ILuaBase::RawGet(int iStackPos) { lua_rawget(state, iStackPos); }
+
+void ILuaBase::RawSet(int iStackPos) { lua_rawset(state, iStackPos); }
+
+int ILuaBase::ObjLen(int iStackPos) { return lua_objlen(state, iStackPos); }
+
+const char* ILuaBase::GetString(int iStackPos, unsigned int* iOutLen) {
+    size_t len = 0;
+    const char* str = lua_tolstring(state, iStackPos, &len);
+    if (iOutLen) {
+        *iOutLen = static_cast<unsigned int>(len);
+    }
+    return str;
+}
+
+double ILuaBase::GetNumber(int iStackPos) {
+    return lua_tonumber(state, iStackPos);
+}
+
+bool ILuaBase::GetBool(int iStackPos) {
+    return lua_toboolean(state, iStackPos);
+}
+
+void ILuaBase::PushNil() { lua_pushnil(state); }
+
+// as in Garry's Mod, zero length means that string is null-terminated
+void ILuaBase::PushString(const char* val, unsigned int iLen) {
+    if (iLen == 0) {
+        lua_pushstring(state, val);
+    } else {
+        lua_pushlstring(state, val, iLen);
+    }
+}
+
+void ILuaBase::PushNumber(double val) { lua_pushnumber(state, val); }
+
+void ILuaBase::PushBool(bool val) { lua_pushboolean(state, val); }
+
+void ILuaBase::PushCFunction(CFunc val) { lua_pushcfunction(state, val); }
+
+int ILuaBase::ReferenceCreate() { return luaL_ref(state, LUA_REGISTRYINDEX); }
+
+void ILuaBase::ReferenceFree(int i) { luaL_unref(state, LUA_REGISTRYINDEX, i); }
+
+void ILuaBase::ReferencePush(int i) {
+    lua_rawgeti(state, LUA_REGISTRYINDEX, i);
+}
+
+bool ILuaBase::IsType(int iStackPos, int iType) {
+    if (iType < FIRST_USER_TYPE) {
+        return lua_type(state, iStackPos) == iType;
+    }
+
+    auto ud = static_cast<UserData*>(lua_touserdata(state, iStackPos));
+    return lua_type(state, iStackPos) == LUA_TUSERDATA && ud &&
+           ud->type == iType;
+}
+
+int ILuaBase::GetType(int iStackPos) {
+    int type = lua_type(state, iStackPos);
+    if (type == LUA_TUSERDATA) {
+        return static_cast<UserData*>(lua_touserdata(state, iStackPos))->type;
+    }
+    return type;
+}
+
+const char* ILuaBase::GetTypeName(int iType) {
+    if (iType >= FIRST_USER_TYPE) {
+        return user_types[iType - FIRST_USER_TYPE].c_str();
+    }
+    return lua_typename(state, iType);
+}
+
+int ILuaBase::CreateMetaTable(const char* strName) {
+    for (size_t i = 0; i < user_types.size(); i++) {
+        if (user_types[i] == strName) {
+            luaL_getmetatable(state, strName);
+            return FIRST_USER_TYPE + i;
+        }
+    }
+
+    luaL_newmetatable(state, strName);
+    user_types.push_back(strName);
+    return FIRST_USER_TYPE + user_types.size() - 1;
+}
+
+bool ILuaBase::PushMetaTable(int iType) {
+    if (iType < FIRST_USER_TYPE) {
+        return false;
+    }
+    luaL_getmetatable(state, user_types[iType - FIRST_USER_TYPE].c_str());
+    return true;
+}
+
+void ILuaBase::PushUserType(void* data, int iType) {
+    auto ud = static_cast<UserData*>(lua_newuserdata(state, sizeof(UserData)));
+    ud->data = data;
+    ud->type = iType;
+}
+
+void ILuaBase::SetUserType(int iStackPos, void* data) {
+    static_cast<UserData*>(lua_touserdata(state, iStackPos))->data = data;
+}
+
+void* ILuaBase::GetUserTypeData(int iStackPos, int iType) {
+    if (!IsType(iStackPos, iType)) {
+        return nullptr;
+    }
+    return static_cast<UserData*>(lua_touserdata(state, iStackPos))->data;
+}
+
+void ILuaInterface::Msg(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    std::vprintf(fmt, args);
+    va_end(args);
+}
+
+ILuaInterface* async_postgres::bench::create_lua_interface() {
+    auto state = luaL_newstate();
+    luaL_openlibs(state);
+    return new ILuaInterface(state);
+}
+
+void async_postgres::bench::close_lua_interface(ILuaInterface* lua) {
+    lua_close(lua->GetState());
+    delete lua;
+}
+
+void async_postgres::bench::collect_garbage(ILuaInterface* lua) {
+    lua->GetField(INDEX_GLOBAL, "collectgarbage");
+    lua->Call(0, 0);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <GarrysMod/Lua/LuaInterface.h>
+
+namespace async_postgres::bench {
+    // creates lua interface over a new LuaJIT state with standard libraries
+    GarrysMod::Lua::ILuaInterface* create_lua_interface();
+    void close_lua_interface(GarrysMod::Lua::ILuaInterface* lua);
+    // runs full garbage collection cycle,
+    // so garbage from one benchmark won't be collected in the next one
+    void collect_garbage(GarrysMod::Lua::ILuaInterface* lua);
+}  // namespace async_postgres::bench
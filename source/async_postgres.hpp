@@ -4,15 +4,24 @@
 #include <GarrysMod/Lua/LuaInterface.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <list>
 #include <memory>
 #include <queue>
 #include <stdexcept>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
 #include "safe_pg.hpp"
+#include "spsc_queue.hpp"
 
 #define LUA_API_VERSION 1
 
@@ -40,19 +49,53 @@ namespace async_postgres {
     typedef std::variant<std::nullptr_t, std::string, double, bool> ParamValue;
 
     struct ParamValues {
-        ParamValues(int n_params)
-            : strings(n_params),
-              values(n_params),
-              lengths(n_params, 0),
-              formats(n_params, 0) {}
+        static constexpr size_t NO_OFFSET = -1;
 
-        inline int length() const { return strings.size(); }
+        ParamValues(int n_params = 0) { resize(n_params); }
+        // values point into the arena, so copies would point into original
+        ParamValues(const ParamValues&) = delete;
+        ParamValues(ParamValues&&) = default;
+        ParamValues& operator=(ParamValues&&) = default;
 
-        std::vector<std::string> strings;
+        inline int length() const { return values.size(); }
+
+        // clears all params, allocated memory is kept for reuse
+        void resize(int n_params);
+        // copies value into the arena, pointer is set by bind_values
+        void set_value(int i, std::string_view value);
+        // points value at the lua string on top of the stack
+        // and keeps reference to it, so string stays alive
+        void pin_value(GLua::ILuaInterface* lua, int i);
+        // points values into the arena, after all values were set
+        void bind_values();
+
+        // values of all params one after another, null-terminated
+        std::vector<char> arena;
+        // offset of the value in the arena, NO_OFFSET if it's not there
+        std::vector<size_t> offsets;
+        // lua strings which are sent without copying
+        std::vector<GLua::AutoReference> pinned;
         // vectors below are used in PQexecParams-like functions
         std::vector<const char*> values;
         std::vector<int> lengths;
         std::vector<int> formats;
+        // 0 means that server will infer the type
+        std::vector<Oid> types;
+    };
+
+    // How lua values are encoded into query parameters
+    struct ParamOptions {
+        // numbers are sent as binary int8/float8 and booleans as binary bool,
+        // strings are sent as text and type is inferred by the server
+        bool typed = false;
+        // with typed params strings are sent as binary bytea
+        bool bytea = false;
+        // prepared statements don't accept param types,
+        // so numbers and booleans are sent as text
+        bool with_types = true;
+        // strings of at least this size are pinned instead of copied,
+        // 0 means that every string is copied
+        size_t pin_size = 0;
     };
 
     struct SocketStatus {
@@ -61,6 +104,14 @@ namespace async_postgres {
         bool failed = false;
     };
 
+    // socket registered in the poller,
+    // poll_connections stores its readiness into status
+    struct PollRegistration {
+        SocketStatus* status;
+        int fd = -1;
+        bool write = false;
+    };
+
     struct SimpleCommand {
         std::string command;
     };
@@ -73,6 +124,8 @@ namespace async_postgres {
     struct CreatePreparedCommand {
         std::string name;
         std::string command;
+        // empty means that server will infer param types
+        std::vector<Oid> types = {};
     };
 
     struct PreparedCommand {
@@ -88,18 +141,237 @@ namespace async_postgres {
         std::string name;
     };
 
+    // queryParams which is executed through the statement cache,
+    // statement is prepared right before the query is sent
+    struct CachedCommand {
+        std::string command;
+        ParamValues param;
+        // name of the prepared statement, set when query is sent
+        std::string name = {};
+    };
+
+    // one statement executed with many param sets, all executions are sent
+    // back-to-back with a single sync, so they run in one implicit transaction
+    struct ExecuteManyCommand {
+        // name of the prepared statement or SQL, which is prepared
+        // as unnamed statement in the same batch
+        std::string command;
+        bool prepared = false;
+        std::vector<ParamValues> params;
+        // aggregated results of the executions
+        size_t results = 0;
+        uint64_t affected = 0;
+        // first failed execution, following ones are aborted by the server
+        pg::result error{nullptr, &PQclear};
+        // 1-based index of the failed param set, 0 if preparation failed
+        size_t error_index = 0;
+    };
+
+    // COPY ... FROM STDIN, rows are pulled from the lua source
+    // and sent in batches while the server is in COPY IN state
+    struct CopyFromCommand {
+        std::string command;
+        // array of rows, or function which returns next row
+        GLua::AutoReference source;
+        // server is waiting for COPY data
+        bool copying = false;
+        int columns = 0;
+        // next index in the source array
+        int next_row = 1;
+        bool source_done = false;
+        // encoded rows which weren't queued into libpq yet
+        std::string buffer;
+        // if not empty, COPY will be aborted with this message
+        std::string error;
+    };
+
+    // COPY ... TO STDOUT, data is written into the file without lua
+    struct CopyToFileCommand {
+        std::string command;
+        // relative to the data directory
+        std::string path;
+        // opened when server starts sending data
+        std::unique_ptr<std::FILE, int (*)(std::FILE*)> file{nullptr,
+                                                             &std::fclose};
+        // server is sending COPY data
+        bool copying = false;
+        size_t bytes = 0;
+        size_t rows = 0;
+        // set if data couldn't be written into the file
+        std::string error;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // log-linear histogram of microseconds, every power of two
+    // is split into 4 buckets, so values are precise up to 25%
+    struct Histogram {
+        static constexpr size_t SUB_BUCKETS = 4;
+        static constexpr size_t BUCKETS = 64 * SUB_BUCKETS;
+
+        std::array<uint64_t, BUCKETS> buckets = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        void record(uint64_t value);
+        // returns upper bound of the bucket which contains percentile
+        uint64_t percentile(double p) const;
+    };
+
+    struct Metrics {
+        // submission -> query is sent
+        Histogram queue_time;
+        // query is sent -> first result is received
+        Histogram first_result_time;
+        // submission -> query is done
+        Histogram total_time;
+        Histogram callback_time;
+        uint64_t queries = 0;
+        uint64_t queue_depth_max = 0;
+        // only payload is counted: SQL, params, values and COPY data
+        uint64_t bytes_sent = 0;
+        uint64_t bytes_received = 0;
+        // sum of PQresultMemorySize of received results
+        uint64_t result_memory = 0;
+        uint64_t rows = 0;
+    };
+
+    // cancel request which is sent by one of the helper threads
+    struct CancelRequest {
+        CancelRequest(PGcancel* cancel) : cancel(cancel) {}
+        ~CancelRequest() { PQfreeCancel(cancel); }
+
+        PGcancel* cancel;
+        Clock::time_point requested = Clock::now();
+        // set by the helper thread when PQcancel has returned
+        std::atomic<bool> done = false;
+        std::atomic<bool> succeeded = false;
+    };
+
+    // result of the query is stored in the result cache
+    struct CacheRequest {
+        CacheRequest() = default;
+        CacheRequest(const CacheRequest&) = delete;
+        // tags are no longer tracked for the running query
+        ~CacheRequest();
+
+        std::string key;
+        // entry is removed when NOTIFY is received on any of these channels
+        std::vector<std::string> tags;
+        // milliseconds, 0 means that entry doesn't expire
+        int ttl = 0;
+        // results which were received after invalidation aren't stored
+        uint64_t generation = 0;
+        bool started = false;
+    };
+
+    // result found in the result cache, it's delivered on the next loop
+    // with result options which were set when it was requested
+    struct CachedHit {
+        std::shared_ptr<PGresult> result;
+        GLua::AutoReference callback;
+        bool array_result = false;
+        bool lazy_result = false;
+        bool columnar_result = false;
+    };
+
     struct Query {
         using CommandVariant =
             std::variant<SimpleCommand, ParameterizedCommand,
                          CreatePreparedCommand, PreparedCommand,
-                         DescribePreparedCommand, DescribePortalCommand>;
+                         DescribePreparedCommand, DescribePortalCommand,
+                         CopyFromCommand, CopyToFileCommand,
+                         CachedCommand, ExecuteManyCommand>;
 
         Query(CommandVariant&& command) : command(std::move(command)) {}
 
         CommandVariant command;
         GLua::AutoReference callback;
+        bool array_result = false;
+        // request results in binary format, only for queries with params
+        bool binary_result = false;
+        // result is passed as PGLazyResult userdata,
+        // rows are converted on access
+        bool lazy_result = false;
+        // result has one array per column instead of rows
+        bool columnar_result = false;
         bool sent = false;
-        bool flushed = false;
+        // queued by the module itself (PREPARE, DEALLOCATE, LISTEN),
+        // such queries aren't counted as pending ones and in metrics
+        bool internal = false;
+
+        // milliseconds since query was sent, after which it's cancelled
+        int timeout = 0;
+        bool timed_out = false;
+        // cancel request which was sent when query timed out
+        std::shared_ptr<CancelRequest> cancel;
+
+        // timestamps for metrics
+        Clock::time_point submitted = Clock::now();
+        Clock::time_point sent_at;
+        bool has_result = false;
+
+        // if greater than zero, rows will be delivered
+        // to the callback in chunks of given size
+        int chunk_size = 0;
+        // single row results which weren't delivered yet
+        std::vector<pg::result> rows;
+        int rows_count = 0;
+
+        std::unique_ptr<CacheRequest> cache;
+    };
+
+    // how many completed queries connection keeps for reuse
+    constexpr size_t MAX_RETIRED_QUERIES = 64;
+
+    // reuses command of the same type, so its buffers aren't reallocated
+    template <typename T>
+    inline T& reuse_command(Query& query) {
+        if (auto command = std::get_if<T>(&query.command)) {
+            return *command;
+        }
+        return query.command.emplace<T>();
+    }
+
+    // Notice message copied out of libpq, so it can be delivered later
+    struct Notice {
+        std::string message;
+        std::string status;
+        std::vector<std::pair<const char*, std::string>> fields;
+    };
+
+    // State of connection which I/O is done by the worker thread
+    struct WorkerConnection {
+        // queries sent by main thread
+        SpscQueue<Query*, 1024> submissions;
+        // results received by worker, nullptr marks end of query results
+        SpscQueue<PGresult*, 1024> results;
+        SpscQueue<PGnotify*, 1024> notifications;
+        SpscQueue<Notice*, 256> notices;
+
+        // fields below are used only by worker thread
+        std::deque<Query*> unsent;
+        // queries which results are being received, front is the current one
+        std::deque<Query*> sent;
+        // values which didn't fit into queues, while there are results
+        // main thread is behind and worker stops reading from socket
+        std::deque<PGresult*> pending_results;
+        std::deque<PGnotify*> pending_notifications;
+        std::deque<Notice*> pending_notices;
+        PQnoticeReceiver main_notice_receiver = nullptr;
+        bool flushed = true;
+        bool readable = false;
+        bool broken = false;
+
+        ~WorkerConnection();
+    };
+
+    // callback of the channel registered with conn:listen
+    struct Listener {
+        GLua::AutoReference callback;
+        // same payloads received in one tick are delivered once
+        bool coalesce = false;
     };
 
     struct ResetEvent {
@@ -107,20 +379,70 @@ namespace async_postgres {
         PostgresPollingStatusType status = PGRES_POLLING_WRITING;
     };
 
+    // prepared statements which were created for queryParams,
+    // least recently used statements are deallocated when cache is full
+    struct StatementCache {
+        struct Entry {
+            std::string name;
+            std::list<std::string>::iterator position;
+        };
+
+        // 0 means that cache is disabled
+        size_t capacity = 0;
+        size_t next_id = 0;
+        // keys in order of use, front is the most recently used one
+        std::list<std::string> order;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
     struct Connection {
         GLua::ILuaInterface* lua;
         pg::conn conn;
-        std::shared_ptr<Query> query;
+        // queries in order they were added, front is the oldest one
+        // sent queries are always placed before queries waiting to be sent
+        std::deque<std::shared_ptr<Query>> queries;
+        // result which was received, but not processed before tick was over
+        pg::result held_result{nullptr, &PQclear};
         std::shared_ptr<ResetEvent> reset_event;
+        // queries aren't sent until the last cancel request is finished,
+        // otherwise it might cancel the next query
+        std::shared_ptr<CancelRequest> cancel_request;
         GLua::AutoReference on_notify;
         GLua::AutoReference on_notice;
+        // completed queries, which are reused when nothing refers to them
+        std::vector<std::shared_ptr<Query>> retired_queries;
+        // notifications of these channels aren't passed to on_notify
+        std::unordered_map<std::string, Listener> listeners;
+        // tags of cached results, they are listened even without listeners
+        std::unordered_set<std::string> cache_channels;
+        std::deque<CachedHit> cached_hits;
+        // received by the worker, but not delivered before it was detached
+        std::deque<pg::notify> detached_notifications;
+        std::deque<std::unique_ptr<Notice>> detached_notices;
         bool array_result = false;
+        bool binary_result = false;
+        bool lazy_result = false;
+        bool columnar_result = false;
+        ParamOptions param_options;
+        StatementCache statements;
+        Metrics metrics;
+        int chunk_size = 0;
+        int query_timeout = 0;
+        bool pipeline = false;
+        bool flushed = true;
+        // socket I/O is done by the worker thread when worker is present
+        bool threaded = false;
+        std::unique_ptr<WorkerConnection> worker;
+        // readiness of the socket, updated once per loop by poll_connections
+        SocketStatus socket;
+        PollRegistration registration = {&socket};
 
         Connection(GLua::ILuaInterface* lua, pg::conn&& conn);
         ~Connection();
     };
 
     extern int connection_meta;
+    extern int result_meta;
     extern std::vector<Connection*> connections;
 
     // connection.cpp
@@ -128,23 +450,183 @@ namespace async_postgres {
                  GLua::AutoReference&& callback);
     void process_pending_connections(GLua::ILuaInterface* lua);
 
+    // sent queries fail with given error
     void reset(GLua::ILuaInterface* lua, Connection* state,
-               GLua::AutoReference&& callback);
+               GLua::AutoReference&& callback,
+               const char* error = "connection was reset");
     void process_reset(GLua::ILuaInterface* lua, Connection* state);
 
     // notifications.cpp
     void process_notifications(GLua::ILuaInterface* lua, Connection* state);
+    // queues LISTEN or UNLISTEN query for the channel
+    void queue_listen(Connection* state, const std::string& channel,
+                      bool listen);
+    // listeners are lost on reset, LISTEN queries are queued before others
+    void restore_listeners(Connection* state);
 
     // query.cpp
     void process_result(GLua::ILuaInterface* lua, Connection* state,
                         pg::result&& result);
     void process_query(GLua::ILuaInterface* lua, Connection* state);
+    void fail_sent_queries(GLua::ILuaInterface* lua, Connection* state,
+                           const char* error);
+    void fail_pending_queries(GLua::ILuaInterface* lua, Connection* state,
+                              const char* error);
+    void set_pipeline_mode(Connection* state, bool enabled);
+    bool send_query(PGconn* conn, Query* query, bool pipeline);
+    void set_row_mode(PGconn* conn, int chunk_size);
+    // returns completed query from the connection's pool, or a new one
+    std::shared_ptr<Query> acquire_query(Connection* state);
+    // if there are queries which can be sent right now
+    bool can_send_queries(Connection* state);
+    // waits until any of the connections has something to process,
+    // readiness of polled sockets is stored in Connection::socket
+    bool wait_for_socket(const std::vector<Connection*>& states,
+                         int timeout = -1);
+    // adds query from lua to the end of the queue
+    void submit_query(Connection* state, std::shared_ptr<Query>&& query);
+    // copies result options of the connection into the submitted query
+    void apply_query_options(Connection* state, Query* query);
+
+    // cancel.cpp
+    // sends cancel request from one of the helper threads
+    // returns nullptr if request can't be made
+    std::shared_ptr<CancelRequest> request_cancel(Connection* state);
+    void stop_cancel_thread();
+    // cancels the running query if it exceeded its timeout,
+    // and resets connection if server didn't cancel it in time
+    void check_query_timeout(GLua::ILuaInterface* lua, Connection* state);
+
+    // copy.cpp
+    // handles PGRES_COPY_IN/PGRES_COPY_OUT result of the front query
+    // returns false if front query doesn't expect COPY
+    bool start_copy(Connection* state, const PGresult* result);
+    // sends or receives COPY data of the front query, unless unlimited is set
+    // amount of data per call is limited, so game thread won't be blocked
+    // returns true if COPY is still in progress
+    bool process_copy(GLua::ILuaInterface* lua, Connection* state,
+                      bool unlimited = false);
+    bool copy_in_progress(Connection* state);
+    // throws if copyToFile isn't allowed to write into the path,
+    // path is relative to the data directory
+    void check_data_path(std::string_view path);
+    void create_copy_result_table(GLua::ILuaInterface* lua,
+                                  const PGresult* result,
+                                  const CopyToFileCommand& copy);
+
+    // scheduler.cpp
+    // limits how long loop can process results in one tick
+    void set_tick_budget(int64_t microseconds);
+    int64_t get_tick_budget();
+    // returns index of the connection which should be processed first
+    size_t begin_tick();
+    void end_tick(size_t start, size_t processed);
+    // returns true if current tick ran out of time,
+    // remaining results will be processed in the next tick
+    bool tick_budget_exceeded();
+
+    // statement_cache.cpp
+    // makes sure that statement of the cached query at given index
+    // is prepared, queries which prepare it are inserted before it
+    void prepare_cached_statement(Connection* state, size_t index);
+    // removes statement which failed to be prepared
+    void invalidate_cached_statement(Connection* state,
+                                     const std::string& name);
+    // forgets every statement, used when connection is reset
+    void clear_statement_cache(Connection* state);
+    // changes capacity, extra statements are deallocated
+    void set_statement_cache_size(Connection* state, size_t capacity);
+
+    // worker.cpp
+    // locks the worker if it owns the connection, so main thread
+    // can call libpq functions which read or change connection state
+    struct ConnectionLock {
+        explicit ConnectionLock(Connection* state);
+        ~ConnectionLock();
+        ConnectionLock(const ConnectionLock&) = delete;
+        ConnectionLock& operator=(const ConnectionLock&) = delete;
+
+        bool locked;
+    };
+
+    void attach_worker(Connection* state);
+    void detach_worker(Connection* state);
+    void stop_worker();
+    void set_threaded_io(GLua::ILuaInterface* lua, Connection* state,
+                         bool enabled);
+    // returns true if result can be received without blocking
+    bool result_ready(Connection* state);
+    // receives next result, blocks if there is no result yet
+    pg::result get_result(Connection* state);
+
+    // metrics.cpp
+    extern Metrics global_metrics;
+    // called when query is submitted, internal queries aren't counted
+    void record_queue_depth(Connection* state);
+    void record_sent(Connection* state, Query* query);
+    // called for every result (or chunk of rows) of the query
+    void record_result(Connection* state, Query* query,
+                       const PGresult* result);
+    void record_completed(Connection* state, Query* query);
+    void record_callback(Connection* state, Clock::time_point started);
+    void record_bytes_sent(Connection* state, size_t bytes);
+    void record_bytes_received(Connection* state, size_t bytes);
+    void create_metrics_table(GLua::ILuaInterface* lua,
+                              const Metrics& metrics);
+
+    // poller.cpp
+    // checks sockets of every connection with a single system call
+    void poll_connections();
+    // registers socket, so its readiness is checked by poll_connections
+    // write readiness is checked only if write is true
+    void watch_socket(PollRegistration& registration, int fd, bool write);
+    // must be called before socket is closed
+    void unwatch_socket(PollRegistration& registration);
+    // returns true if loop has something to do with the connection
+    bool needs_processing(Connection* state);
+    void close_poller();
+
+    // result_cache.cpp
+    // key of the query with given params, results are shared between
+    // connections to the same database and user
+    std::string result_cache_key(PGconn* conn, std::string_view command,
+                                 const ParamValues& param, bool binary);
+    // returns cached result, or nullptr if there is none or it's expired
+    std::shared_ptr<PGresult> find_cached_result(const std::string& key);
+    // remembers generation of the request and starts tracking its tags,
+    // so invalidations which happen while query is running are noticed
+    void start_cache_request(CacheRequest& request);
+    // stores copy of the result, unless it doesn't fit into the cache
+    void store_cached_result(const CacheRequest& request,
+                             const PGresult* result);
+    // removes entries tagged with the channel
+    void invalidate_cached_results(std::string_view tag);
+    void clear_result_cache();
+    bool result_cache_enabled();
+    // changes size limit in bytes, extra entries are removed
+    void set_result_cache_size(size_t capacity);
+    void create_result_cache_table(GLua::ILuaInterface* lua);
 
     // result.cpp
     void create_result_table(GLua::ILuaInterface* lua, PGresult* result,
-                             bool array_result);
+                             bool array_result, bool columnar_result = false);
+    void create_chunk_table(GLua::ILuaInterface* lua,
+                            const std::vector<pg::result>& results,
+                            bool array_result, bool columnar_result = false);
     void create_result_error_table(GLua::ILuaInterface* lua,
                                    const PGresult* result);
+    // pushes PGLazyResult userdata which owns the result
+    void create_lazy_result(GLua::ILuaInterface* lua, pg::result&& result,
+                            bool array_result);
+    // allows results of the connection to carry decoded values
+    void register_result_events(PGconn* conn);
+    // converts values of the result ahead of time, can be called
+    // outside of the main thread, create_result_table will use them
+    void decode_result(PGresult* result);
+    void register_result_mt(GLua::ILuaInterface* lua);
+    Notice* copy_notice(const PGresult* result);
+    void create_notice_error_table(GLua::ILuaInterface* lua,
+                                   const Notice& notice);
 
     // misc.cpp
     void register_misc_connection_functions(GLua::ILuaInterface* lua);
@@ -154,8 +636,11 @@ namespace async_postgres {
     std::string_view get_string(GLua::ILuaInterface* lua, int index = -1);
     void pcall(GLua::ILuaInterface* lua, int nargs, int nresults);
     // Converts a lua array at given index to a ParamValues
-    ParamValues array_to_params(GLua::ILuaInterface* lua, int index);
-    SocketStatus check_socket_status(PGconn* conn);
+    ParamValues array_to_params(GLua::ILuaInterface* lua, int index,
+                                const ParamOptions& options = {});
+    // same, but reuses memory of given params
+    void array_to_params(GLua::ILuaInterface* lua, int index,
+                         const ParamOptions& options, ParamValues& param);
     bool wait_for_socket(PGconn* conn, bool write = false, bool read = false,
                          int timeout = -1);
 };  // namespace async_postgres
@@ -0,0 +1,147 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+// PQcancel blocks until server receives the request,
+// so requests are sent by helper threads, several of them
+// so one unreachable server won't delay cancels of other connections
+constexpr size_t MAX_CANCEL_THREADS = 4;
+
+// how long server has to cancel timed out query,
+// before connection is reset
+constexpr auto CANCEL_GRACE_PERIOD = std::chrono::seconds(5);
+
+// how long module close waits for PQcancel calls in progress,
+// threads which are still blocked after that are detached
+constexpr auto CANCEL_STOP_TIMEOUT = std::chrono::seconds(1);
+
+std::mutex cancel_mutex;
+std::condition_variable cancel_condition;
+std::condition_variable cancel_stopped;
+std::deque<std::shared_ptr<CancelRequest>> cancel_requests;
+std::vector<std::thread> cancel_threads;
+size_t idle_cancel_threads = 0;
+// threads which haven't left cancel_loop yet
+size_t running_cancel_threads = 0;
+bool cancel_running = false;
+
+void cancel_loop() {
+    std::unique_lock<std::mutex> lock(cancel_mutex);
+    while (true) {
+        idle_cancel_threads++;
+        cancel_condition.wait(lock, [] {
+            return !cancel_running || !cancel_requests.empty();
+        });
+        idle_cancel_threads--;
+        if (!cancel_running) {
+            break;
+        }
+
+        auto request = std::move(cancel_requests.front());
+        cancel_requests.pop_front();
+        lock.unlock();
+
+        char error[256];
+        request->succeeded =
+            PQcancel(request->cancel, error, sizeof(error)) == 1;
+        request->done = true;
+        request.reset();
+
+        lock.lock();
+    }
+
+    running_cancel_threads--;
+    cancel_stopped.notify_all();
+}
+
+std::shared_ptr<CancelRequest> async_postgres::request_cancel(
+    Connection* state) {
+    PGcancel* cancel;
+    {
+        ConnectionLock lock(state);
+        cancel = PQgetCancel(state->conn.get());
+    }
+    if (!cancel) {
+        return nullptr;
+    }
+
+    auto request = std::make_shared<CancelRequest>(cancel);
+    state->cancel_request = request;
+
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex);
+        cancel_running = true;
+        cancel_requests.push_back(request);
+
+        if (idle_cancel_threads < cancel_requests.size() &&
+            cancel_threads.size() < MAX_CANCEL_THREADS) {
+            cancel_threads.emplace_back(cancel_loop);
+            running_cancel_threads++;
+        }
+    }
+
+    cancel_condition.notify_one();
+    return request;
+}
+
+void async_postgres::stop_cancel_thread() {
+    std::unique_lock<std::mutex> lock(cancel_mutex);
+    if (!cancel_running) {
+        return;
+    }
+    cancel_running = false;
+    cancel_condition.notify_all();
+
+    // PQcancel can block until network timeout,
+    // so closing the module (or changing the map) must not wait for it
+    bool stopped = cancel_stopped.wait_for(lock, CANCEL_STOP_TIMEOUT, [] {
+        return running_cancel_threads == 0;
+    });
+
+    // requests which weren't sent before module was closed
+    cancel_requests.clear();
+    lock.unlock();
+
+    for (auto& thread : cancel_threads) {
+        if (stopped) {
+            thread.join();
+        } else {
+            thread.detach();
+        }
+    }
+    cancel_threads.clear();
+}
+
+void async_postgres::check_query_timeout(GLua::ILuaInterface* lua,
+                                         Connection* state) {
+    if (state->reset_event || state->queries.empty() ||
+        !state->queries.front()->sent) {
+        return;
+    }
+
+    auto& query = *state->queries.front();
+    auto timeout = std::chrono::milliseconds(query.timeout);
+    if (query.timeout <= 0 || Clock::now() - query.sent_at < timeout) {
+        return;
+    }
+
+    if (!query.timed_out) {
+        query.timed_out = true;
+        query.cancel = request_cancel(state);
+    }
+
+    // wait for the server to cancel the query
+    auto& cancel = query.cancel;
+    if (cancel && (!cancel->done || cancel->succeeded) &&
+        Clock::now() - cancel->requested < CANCEL_GRACE_PERIOD) {
+        return;
+    }
+
+    // cancel request failed or server didn't react to it,
+    // query can't be taken back, so the connection is reset
+    reset(lua, state, {}, "query timed out");
+}
@@ -14,6 +14,10 @@ Connection::~Connection() {
     // remove connection from global list
     // so event loop doesn't try to process it
     connections.erase(std::find(connections.begin(), connections.end(), this));
+
+    // worker must stop using connection before it will be closed
+    detach_worker(this);
+    unwatch_socket(registration);
 }
 
 struct ConnectionEvent {
@@ -21,13 +25,27 @@ struct ConnectionEvent {
     GLua::AutoReference callback;
     PostgresPollingStatusType status = PGRES_POLLING_WRITING;
     bool is_reset = false;
+    // readiness of the socket, updated once per loop by poll_connections
+    SocketStatus socket;
+    PollRegistration registration = {&socket};
+
+    ConnectionEvent(pg::conn&& conn, GLua::AutoReference&& callback)
+        : conn(std::move(conn)), callback(std::move(callback)) {}
+    ConnectionEvent(const ConnectionEvent&) = delete;
+    ~ConnectionEvent() { unwatch_socket(registration); }
 };
 
-std::vector<ConnectionEvent> pending_connections = {};
+// events are registered in the poller, so they must not be moved
+std::list<ConnectionEvent> pending_connections = {};
+
+inline bool socket_is_ready(PGconn* conn, const SocketStatus& socket,
+                            PostgresPollingStatusType status) {
+    // without socket polling function will report an error
+    if (PQsocket(conn) < 0) {
+        return true;
+    }
 
-inline bool socket_is_ready(PGconn* conn, PostgresPollingStatusType status) {
     if (status == PGRES_POLLING_READING || status == PGRES_POLLING_WRITING) {
-        auto socket = check_socket_status(conn);
         return socket.failed ||
                ((status == PGRES_POLLING_READING && socket.read_ready) ||
                 (status == PGRES_POLLING_WRITING && socket.write_ready));
@@ -35,6 +53,17 @@ inline bool socket_is_ready(PGconn* conn, PostgresPollingStatusType status) {
     return true;
 }
 
+// polling might replace the socket, and new one
+// might get the same descriptor, so it's registered again
+inline void watch_polled_socket(PGconn* conn, PollRegistration& registration,
+                                PostgresPollingStatusType status) {
+    unwatch_socket(registration);
+    if (status == PGRES_POLLING_READING || status == PGRES_POLLING_WRITING) {
+        watch_socket(registration, PQsocket(conn),
+                     status == PGRES_POLLING_WRITING);
+    }
+}
+
 static void noticeReceiver(void* arg, const PGresult* res) {
     auto state = static_cast<Connection*>(arg);
     if (state->on_notice.IsValid()) {
@@ -60,19 +89,21 @@ void async_postgres::connect(GLua::ILuaInterface* lua, std::string_view url,
         throw std::runtime_error(PQerrorMessage(conn.get()));
     }
 
-    auto event = ConnectionEvent{std::move(conn), std::move(callback)};
-    pending_connections.push_back(std::move(event));
+    auto& event =
+        pending_connections.emplace_back(std::move(conn), std::move(callback));
+    watch_polled_socket(event.conn.get(), event.registration, event.status);
 }
 
 // returns true if we finished polling
 // returns false if we need to poll again
 inline bool poll_pending_connection(GLua::ILuaInterface* lua,
                                     ConnectionEvent& event) {
-    if (!socket_is_ready(event.conn.get(), event.status)) {
+    if (!socket_is_ready(event.conn.get(), event.socket, event.status)) {
         return false;
     }
 
     event.status = PQconnectPoll(event.conn.get());
+    watch_polled_socket(event.conn.get(), event.registration, event.status);
     if (event.status == PGRES_POLLING_OK) {
         auto state = new Connection(lua, std::move(event.conn));
 
@@ -112,13 +143,27 @@ void async_postgres::process_pending_connections(GLua::ILuaInterface* lua) {
 }
 
 void async_postgres::reset(GLua::ILuaInterface* lua, Connection* state,
-                           GLua::AutoReference&& callback) {
+                           GLua::AutoReference&& callback, const char* error) {
     if (!state->reset_event) {
+        // reset is polled by main thread
+        detach_worker(state);
+        // new socket might get the same descriptor as the old one
+        unwatch_socket(state->registration);
+
         if (PQresetStart(state->conn.get()) == 0) {
             throw std::runtime_error(PQerrorMessage(state->conn.get()));
         }
 
         state->reset_event = std::make_shared<ResetEvent>();
+
+        // prepared statements don't survive the reset
+        clear_statement_cache(state);
+
+        // cancel request can't reach the new connection
+        state->cancel_request.reset();
+
+        // results of already sent queries are lost with old connection
+        fail_sent_queries(lua, state, error);
     }
 
     if (callback) {
@@ -133,14 +178,29 @@ void async_postgres::process_reset(GLua::ILuaInterface* lua,
     }
 
     auto event = state->reset_event;
-    if (!socket_is_ready(state->conn.get(), state->reset_event->status)) {
+    if (!socket_is_ready(state->conn.get(), state->socket, event->status)) {
         return;
     }
 
     event->status = PQresetPoll(state->conn.get());
+    // socket is registered again by poll_connections
+    unwatch_socket(state->registration);
     if (event->status == PGRES_POLLING_OK) {
         state->reset_event.reset();
 
+        // pipeline mode is not preserved between connections
+        if (state->pipeline &&
+            PQpipelineStatus(state->conn.get()) == PQ_PIPELINE_OFF) {
+            state->pipeline = PQenterPipelineMode(state->conn.get()) == 1;
+        }
+
+        // server forgets channels which were listened by previous session
+        restore_listeners(state);
+
+        if (state->threaded) {
+            attach_worker(state);
+        }
+
         for (auto& callback : event->callbacks) {
             callback.Push();
             lua->PushBool(true);
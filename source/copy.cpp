@@ -0,0 +1,371 @@
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+// rows are encoded and queued into libpq in batches of this size
+constexpr size_t COPY_BATCH_SIZE = 64 * 1024;
+// limits how much data is sent in one call,
+// so big sources won't block the game thread for too long
+constexpr size_t COPY_BYTES_PER_CALL = 1024 * 1024;
+
+// directory where copyToFile writes files, relative to the server root
+constexpr std::string_view DATA_DIRECTORY = "garrysmod/data/";
+// size of stdio buffer of files written by copyToFile
+constexpr size_t COPY_FILE_BUFFER_SIZE = 64 * 1024;
+// extensions which file.Write allows
+constexpr std::array<std::string_view, 13> DATA_FILE_EXTENSIONS = {
+    ".txt", ".dat", ".json", ".xml", ".csv", ".jpg",  ".jpeg",
+    ".png", ".vtf", ".vmt",  ".mp3", ".wav", ".ogg",
+};
+
+template <typename T>
+inline T* get_copy_command(Connection* state) {
+    if (state->queries.empty() || !state->queries.front()->sent) {
+        return nullptr;
+    }
+    return std::get_if<T>(&state->queries.front()->command);
+}
+
+// see "Text Format" in COPY documentation
+inline void append_copy_string(std::string& out, std::string_view value) {
+    for (char c : value) {
+        switch (c) {
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            default:
+                out += c;
+        }
+    }
+}
+
+inline void append_copy_number(std::string& out, double value) {
+    char buffer[32];
+    int length;
+    // integers are written without exponent, so they fit into integer columns
+    if (std::floor(value) == value && std::abs(value) < 1e15) {
+        length = std::snprintf(buffer, sizeof(buffer), "%.0f", value);
+    } else {
+        length = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    }
+    out.append(buffer, length);
+}
+
+// appends value on top of the stack
+// returns false if value can't be encoded
+inline bool append_copy_value(GLua::ILuaInterface* lua, std::string& out) {
+    switch (lua->GetType(-1)) {
+        case GLua::Type::Nil:
+            out += "\\N";
+            return true;
+        case GLua::Type::String:
+            append_copy_string(out, get_string(lua, -1));
+            return true;
+        case GLua::Type::Number:
+            append_copy_number(out, lua->GetNumber(-1));
+            return true;
+        case GLua::Type::Bool:
+            out += lua->GetBool(-1) ? 't' : 'f';
+            return true;
+        default:
+            return false;
+    }
+}
+
+// pushes next row of the source onto the stack
+// returns false if source is exhausted or failed
+inline bool pull_copy_row(GLua::ILuaInterface* lua, CopyFromCommand& copy) {
+    copy.source.Push();
+    if (lua->IsType(-1, GLua::Type::Function)) {
+        if (lua->PCall(0, 1, 0) != 0) {
+            copy.error = get_string(lua, -1);
+            lua->Pop();
+            return false;
+        }
+    } else {
+        lua->PushNumber(copy.next_row++);
+        lua->GetTable(-2);
+        lua->Remove(-2);
+    }
+
+    if (lua->IsType(-1, GLua::Type::Nil)) {
+        lua->Pop();
+        return false;
+    }
+    return true;
+}
+
+// encodes rows until batch is full or source is exhausted
+inline void encode_copy_rows(GLua::ILuaInterface* lua, CopyFromCommand& copy) {
+    while (copy.buffer.size() < COPY_BATCH_SIZE) {
+        if (!pull_copy_row(lua, copy)) {
+            copy.source_done = true;
+            break;
+        }
+
+        if (!lua->IsType(-1, GLua::Type::Table)) {
+            copy.error = "copyFrom row must be a table";
+            copy.source_done = true;
+            lua->Pop();
+            break;
+        }
+
+        // missing values are sent as NULL,
+        // so number of columns is taken from the server
+        for (int i = 1; i <= copy.columns; i++) {
+            if (i > 1) {
+                copy.buffer += '\t';
+            }
+
+            lua->PushNumber(i);
+            lua->GetTable(-2);
+            bool ok = append_copy_value(lua, copy.buffer);
+            lua->Pop();
+
+            if (!ok) {
+                copy.error = "unsupported type given into copyFrom row";
+                copy.source_done = true;
+                break;
+            }
+        }
+        copy.buffer += '\n';
+
+        lua->Pop();
+        if (!copy.error.empty()) {
+            break;
+        }
+    }
+
+    // partial data must not be sent when COPY is going to be aborted
+    if (!copy.error.empty()) {
+        copy.buffer.clear();
+    }
+}
+
+inline bool has_data_file_extension(std::string_view path) {
+    auto dot = path.find_last_of("./\\");
+    if (dot == std::string_view::npos || path[dot] != '.') {
+        return false;
+    }
+
+    std::string extension(path.substr(dot));
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return std::find(DATA_FILE_EXTENSIONS.begin(), DATA_FILE_EXTENSIONS.end(),
+                     extension) != DATA_FILE_EXTENSIONS.end();
+}
+
+void async_postgres::check_data_path(std::string_view path) {
+    // file must stay in data directory, and have extension
+    // which file.Write allows, so it can't be executed or loaded by the game
+    if (path.empty() || path.front() == '/' || path.front() == '\\' ||
+        path.find("..") != std::string_view::npos ||
+        path.find(':') != std::string_view::npos ||
+        !has_data_file_extension(path)) {
+        throw std::runtime_error("invalid path given to copyToFile");
+    }
+}
+
+// file is created only when server has accepted the query,
+// on failure data is still received, so connection can be used again
+inline void open_data_file(CopyToFileCommand& copy) {
+    std::string full_path(DATA_DIRECTORY);
+    full_path += copy.path;
+
+    copy.file.reset(std::fopen(full_path.c_str(), "wb"));
+    if (!copy.file) {
+        copy.error = "failed to open " + full_path;
+        return;
+    }
+
+    std::setvbuf(copy.file.get(), nullptr, _IOFBF, COPY_FILE_BUFFER_SIZE);
+}
+
+bool async_postgres::start_copy(Connection* state, const PGresult* result) {
+    auto status = PQresultStatus(result);
+    if (status == PGRES_COPY_OUT) {
+        auto copy = get_copy_command<CopyToFileCommand>(state);
+        if (copy) {
+            copy->copying = true;
+            open_data_file(*copy);
+        }
+        return copy;
+    }
+
+    if (status != PGRES_COPY_IN) {
+        return false;
+    }
+
+    auto copy = get_copy_command<CopyFromCommand>(state);
+    if (copy) {
+        copy->copying = true;
+        copy->columns = PQnfields(result);
+        return true;
+    }
+
+    // COPY FROM STDIN was sent through a regular query,
+    // server will respond with an error result
+    PQputCopyEnd(state->conn.get(),
+                 "COPY FROM STDIN is only supported by copyFrom");
+    state->flushed = PQflush(state->conn.get()) == 0;
+    return true;
+}
+
+// returns true if COPY is still in progress
+inline bool send_copy_data(GLua::ILuaInterface* lua, Connection* state,
+                           CopyFromCommand& copy, bool unlimited) {
+    auto conn = state->conn.get();
+
+    // wait until socket accepts previous data
+    if (!state->flushed) {
+        state->flushed = PQflush(conn) == 0;
+        if (!state->flushed) {
+            return true;
+        }
+    }
+
+    size_t sent = 0;
+    while (unlimited || sent < COPY_BYTES_PER_CALL) {
+        if (copy.buffer.empty() && !copy.source_done) {
+            encode_copy_rows(lua, copy);
+        }
+
+        if (!copy.buffer.empty()) {
+            int ret =
+                PQputCopyData(conn, copy.buffer.data(), copy.buffer.size());
+            if (ret == 0) {
+                // libpq buffer is full, try again when socket is writable
+                state->flushed = false;
+                return true;
+            } else if (ret < 0) {
+                // connection is broken, PQgetResult will return an error
+                copy.copying = false;
+                return false;
+            }
+
+            sent += copy.buffer.size();
+            record_bytes_sent(state, copy.buffer.size());
+            copy.buffer.clear();
+
+            if (PQflush(conn) == 1) {
+                state->flushed = false;
+                return true;
+            }
+            continue;
+        }
+
+        int ret = PQputCopyEnd(
+            conn, copy.error.empty() ? nullptr : copy.error.c_str());
+        if (ret == 0) {
+            state->flushed = false;
+            return true;
+        }
+
+        // final result of the COPY command will follow
+        copy.copying = false;
+        state->flushed = PQflush(conn) == 0;
+        return false;
+    }
+
+    return true;
+}
+
+// returns true if COPY is still in progress
+inline bool receive_copy_data(Connection* state, CopyToFileCommand& copy,
+                              bool unlimited) {
+    auto conn = state->conn.get();
+    bool consumed = false;
+
+    size_t received = 0;
+    while (unlimited || received < COPY_BYTES_PER_CALL) {
+        char* buffer = nullptr;
+        int length = PQgetCopyData(conn, &buffer, 1);
+        if (length > 0) {
+            // after write error data is still drained, so connection
+            // can be used again, but it goes nowhere
+            if (copy.file && std::fwrite(buffer, 1, length,
+                                         copy.file.get()) != size_t(length)) {
+                copy.error = "failed to write COPY data into the file";
+                copy.file.reset();
+            }
+            PQfreemem(buffer);
+
+            copy.bytes += length;
+            copy.rows++;
+            received += length;
+            record_bytes_received(state, length);
+            continue;
+        }
+
+        if (length == 0) {
+            // read what socket has once, the rest will be read next time
+            if (consumed) {
+                return true;
+            }
+
+            consumed = true;
+            if (PQconsumeInput(conn) == 1) {
+                continue;
+            }
+        }
+
+        // COPY is done or failed, final result will follow
+        if (copy.file && std::fclose(copy.file.release()) != 0 &&
+            copy.error.empty()) {
+            copy.error = "failed to write COPY data into the file";
+        }
+        copy.copying = false;
+        return false;
+    }
+
+    return true;
+}
+
+bool async_postgres::process_copy(GLua::ILuaInterface* lua, Connection* state,
+                                  bool unlimited) {
+    if (auto copy = get_copy_command<CopyFromCommand>(state)) {
+        return copy->copying && send_copy_data(lua, state, *copy, unlimited);
+    }
+    if (auto copy = get_copy_command<CopyToFileCommand>(state)) {
+        return copy->copying && receive_copy_data(state, *copy, unlimited);
+    }
+    return false;
+}
+
+bool async_postgres::copy_in_progress(Connection* state) {
+    if (auto copy = get_copy_command<CopyFromCommand>(state)) {
+        return copy->copying;
+    }
+    if (auto copy = get_copy_command<CopyToFileCommand>(state)) {
+        return copy->copying;
+    }
+    return false;
+}
+
+void async_postgres::create_copy_result_table(GLua::ILuaInterface* lua,
+                                              const PGresult* result,
+                                              const CopyToFileCommand& copy) {
+    lua->CreateTable();
+
+    lua->PushString(PQcmdStatus(const_cast<PGresult*>(result)));
+    lua->SetField(-2, "command");
+
+    lua->PushNumber(copy.rows);
+    lua->SetField(-2, "rows");
+
+    lua->PushNumber(copy.bytes);
+    lua->SetField(-2, "bytes");
+}
@@ -1,3 +1,5 @@
+#include <iterator>
+
 #include "async_postgres.hpp"
 
 int async_postgres::connection_meta = 0;
@@ -14,18 +16,87 @@ namespace async_postgres::lua {
 
     lua_protected_fn(loop) {
         async_postgres::process_pending_connections(lua);
+        async_postgres::poll_connections();
+
+        // callbacks might add or remove connections, so they are accessed
+        // by index, starting connection changes every tick
+        auto& connections = async_postgres::connections;
+        size_t count = connections.size();
+        size_t start = async_postgres::begin_tick();
+        size_t processed = 0;
+
+        for (; processed < count && !connections.empty(); processed++) {
+            if (async_postgres::tick_budget_exceeded()) {
+                break;
+            }
 
-        for (auto* state : async_postgres::connections) {
+            auto* state = connections[(start + processed) % connections.size()];
             if (!state->conn) {
                 lua->Msg("[async_postgres] connection is null for %p\n", state);
                 continue;
             }
 
-            async_postgres::process_notifications(lua, state);
+            async_postgres::check_query_timeout(lua, state);
+
+            // nothing has happened to the connection since last loop
+            if (!async_postgres::needs_processing(state)) {
+                continue;
+            }
+
+            // notifications are processed after queries,
+            // so ones which were read together with results aren't delayed
             async_postgres::process_query(lua, state);
+            async_postgres::process_notifications(lua, state);
             async_postgres::process_reset(lua, state);
         }
 
+        async_postgres::end_tick(start, processed);
+
+        return 0;
+    }
+
+    lua_protected_fn(stats) {
+        async_postgres::create_metrics_table(lua,
+                                             async_postgres::global_metrics);
+        return 1;
+    }
+
+    lua_protected_fn(connectionStats) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        async_postgres::create_metrics_table(lua, state->metrics);
+        return 1;
+    }
+
+    lua_protected_fn(setTickBudget) {
+        lua->CheckType(1, GLua::Type::Number);
+        async_postgres::set_tick_budget(lua->GetNumber(1));
+        return 0;
+    }
+
+    lua_protected_fn(getTickBudget) {
+        lua->PushNumber(async_postgres::get_tick_budget());
+        return 1;
+    }
+
+    lua_protected_fn(setResultCacheSize) {
+        lua->CheckType(1, GLua::Type::Number);
+        async_postgres::set_result_cache_size(
+            std::max<double>(lua->GetNumber(1), 0));
+        return 0;
+    }
+
+    lua_protected_fn(resultCacheStats) {
+        async_postgres::create_result_cache_table(lua);
+        return 1;
+    }
+
+    lua_protected_fn(invalidateResultCache) {
+        if (lua->IsType(1, GLua::Type::String)) {
+            async_postgres::invalidate_cached_results(lua->GetString(1));
+        } else {
+            async_postgres::clear_result_cache();
+        }
         return 0;
     }
 
@@ -46,65 +117,289 @@ namespace async_postgres::lua {
         lua->CheckType(2, GLua::Type::String);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
-        }
-
-        state->query = std::make_shared<async_postgres::Query>(
-            async_postgres::SimpleCommand{
-                lua->GetString(2),
-            });
+        auto query = async_postgres::acquire_query(state);
+        auto& command =
+            async_postgres::reuse_command<async_postgres::SimpleCommand>(
+                *query);
+        command.command.assign(lua->GetString(2));
 
         if (lua->IsType(3, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 3);
+            query->callback = GLua::AutoReference(lua, 3);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
         return 0;
     }
 
+    // query with SQL at index 2 and params at index 3,
+    // sent through the statement cache if it's enabled
+    inline std::shared_ptr<async_postgres::Query> params_query(
+        GLua::ILuaInterface* lua, async_postgres::Connection* state) {
+        auto query = async_postgres::acquire_query(state);
+        if (state->statements.capacity > 0) {
+            auto& command =
+                async_postgres::reuse_command<async_postgres::CachedCommand>(
+                    *query);
+            command.command.assign(lua->GetString(2));
+            command.name.clear();
+            async_postgres::array_to_params(lua, 3, state->param_options,
+                                            command.param);
+        } else {
+            auto& command = async_postgres::reuse_command<
+                async_postgres::ParameterizedCommand>(*query);
+            command.command.assign(lua->GetString(2));
+            async_postgres::array_to_params(lua, 3, state->param_options,
+                                            command.param);
+        }
+        return query;
+    }
+
     lua_protected_fn(queryParams) {
         lua->CheckType(1, async_postgres::connection_meta);
         lua->CheckType(2, GLua::Type::String);
         lua->CheckType(3, GLua::Type::Table);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
+        auto query = params_query(lua, state);
+
+        if (lua->IsType(4, GLua::Type::Function)) {
+            query->callback = GLua::AutoReference(lua, 4);
         }
 
-        state->query = std::make_shared<async_postgres::Query>(
-            async_postgres::ParameterizedCommand{
-                lua->GetString(2),
-                async_postgres::array_to_params(lua, 3),
-            });
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
+        return 0;
+    }
+
+    inline const async_postgres::ParamValues& query_params(
+        const async_postgres::Query& query) {
+        if (auto command =
+                std::get_if<async_postgres::CachedCommand>(&query.command)) {
+            return command->param;
+        }
+        return std::get<async_postgres::ParameterizedCommand>(query.command)
+            .param;
+    }
+
+    lua_protected_fn(queryCached) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+        lua->CheckType(3, GLua::Type::Table);
+        lua->CheckType(4, GLua::Type::Number);
+
+        auto state = lua_connection_state();
+        if (!async_postgres::result_cache_enabled()) {
+            throw std::runtime_error("result cache is disabled");
+        }
+
+        auto query = params_query(lua, state);
+        auto key = async_postgres::result_cache_key(
+            state->conn.get(), lua->GetString(2), query_params(*query),
+            state->binary_result);
+
+        // hit doesn't go through the queue, but callback is still
+        // called from the loop, like callbacks of other queries
+        if (auto result = async_postgres::find_cached_result(key)) {
+            async_postgres::CachedHit hit;
+            hit.result = std::move(result);
+            if (lua->IsType(6, GLua::Type::Function)) {
+                hit.callback = GLua::AutoReference(lua, 6);
+            }
+            hit.array_result = state->array_result;
+            hit.lazy_result = state->lazy_result;
+            hit.columnar_result = state->columnar_result;
+            state->cached_hits.push_back(std::move(hit));
+            return 0;
+        }
+
+        auto cache = std::make_unique<async_postgres::CacheRequest>();
+        cache->key = std::move(key);
+        cache->ttl = std::max<int>(lua->GetNumber(4), 0);
+
+        if (lua->IsType(5, GLua::Type::Table)) {
+            int len = lua->ObjLen(5);
+            for (int i = 1; i <= len; i++) {
+                lua->PushNumber(i);
+                lua->GetTable(5);
+                if (lua->IsType(-1, GLua::Type::String)) {
+                    cache->tags.emplace_back(lua->GetString(-1));
+                }
+                lua->Pop();
+            }
+        }
+
+        async_postgres::start_cache_request(*cache);
+
+        // notifications of tags must be received, even if nobody listens
+        // to them, channels which are already listened aren't listened again
+        for (const auto& tag : cache->tags) {
+            if (state->cache_channels.insert(tag).second &&
+                state->listeners.find(tag) == state->listeners.end()) {
+                async_postgres::queue_listen(state, tag, true);
+            }
+        }
+
+        if (lua->IsType(6, GLua::Type::Function)) {
+            query->callback = GLua::AutoReference(lua, 6);
+        }
+
+        query->cache = std::move(cache);
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
+        return 0;
+    }
+
+    // protocol limit of params in one message
+    constexpr int MAX_PARAMS = 65535;
+
+    // sends statement with every params array from index 3, statement is
+    // SQL or name of prepared statement at index 2
+    inline void execute_many(GLua::ILuaInterface* lua, bool prepared) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+        lua->CheckType(3, GLua::Type::Table);
+
+        auto state = lua_connection_state();
+        if (state->threaded) {
+            throw std::runtime_error(
+                "executeMany is not supported with threaded I/O");
+        }
+
+        // statement is prepared before params are known,
+        // so their types are inferred by the server
+        auto options = state->param_options;
+        options.with_types = false;
+
+        async_postgres::ExecuteManyCommand many;
+        many.command = lua->GetString(2);
+        many.prepared = prepared;
+
+        int count = lua->ObjLen(3);
+        if (count == 0) {
+            throw std::runtime_error(
+                "executeMany requires at least one params array");
+        }
+
+        many.params.reserve(count);
+        for (int i = 1; i <= count; i++) {
+            lua->PushNumber(i);
+            lua->GetTable(3);
+            if (!lua->IsType(-1, GLua::Type::Table)) {
+                throw std::runtime_error(
+                    "executeMany params must be an array of tables");
+            }
+            many.params.push_back(
+                async_postgres::array_to_params(lua, -1, options));
+            lua->Pop();
+
+            // checked here, so sending can't fail in the middle of batch
+            if (many.params.back().length() > MAX_PARAMS) {
+                throw std::runtime_error("too many params in executeMany");
+            }
+        }
+
+        auto query = std::make_shared<async_postgres::Query>(std::move(many));
 
         if (lua->IsType(4, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 4);
+            query->callback = GLua::AutoReference(lua, 4);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+    }
+
+    lua_protected_fn(executeMany) {
+        execute_many(lua, false);
         return 0;
     }
 
-    lua_protected_fn(prepare) {
+    lua_protected_fn(executeManyPrepared) {
+        execute_many(lua, true);
+        return 0;
+    }
+
+    lua_protected_fn(copyFrom) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+        if (!lua->IsType(3, GLua::Type::Table)) {
+            lua->CheckType(3, GLua::Type::Function);
+        }
+
+        auto state = lua_connection_state();
+        if (state->pipeline || state->threaded) {
+            throw std::runtime_error(
+                "copyFrom is not supported in pipeline mode "
+                "or with threaded I/O");
+        }
+
+        async_postgres::CopyFromCommand copy;
+        copy.command = lua->GetString(2);
+        copy.source = GLua::AutoReference(lua, 3);
+
+        auto query = std::make_shared<async_postgres::Query>(std::move(copy));
+
+        if (lua->IsType(4, GLua::Type::Function)) {
+            query->callback = GLua::AutoReference(lua, 4);
+        }
+
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
+        return 0;
+    }
+
+    lua_protected_fn(copyToFile) {
         lua->CheckType(1, async_postgres::connection_meta);
         lua->CheckType(2, GLua::Type::String);
         lua->CheckType(3, GLua::Type::String);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
+        if (state->pipeline || state->threaded) {
+            throw std::runtime_error(
+                "copyToFile is not supported in pipeline mode "
+                "or with threaded I/O");
+        }
+
+        async_postgres::CopyToFileCommand copy;
+        copy.command = lua->GetString(2);
+        copy.path = lua->GetString(3);
+        async_postgres::check_data_path(copy.path);
+
+        auto query = std::make_shared<async_postgres::Query>(std::move(copy));
+
+        if (lua->IsType(4, GLua::Type::Function)) {
+            query->callback = GLua::AutoReference(lua, 4);
         }
 
-        state->query = std::make_shared<async_postgres::Query>(
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
+        return 0;
+    }
+
+    lua_protected_fn(prepare) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+        lua->CheckType(3, GLua::Type::String);
+
+        auto state = lua_connection_state();
+        auto query = std::make_shared<async_postgres::Query>(
             async_postgres::CreatePreparedCommand{
                 lua->GetString(2),
                 lua->GetString(3),
             });
 
         if (lua->IsType(4, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 4);
+            query->callback = GLua::AutoReference(lua, 4);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
         return 0;
     }
 
@@ -114,20 +409,24 @@ namespace async_postgres::lua {
         lua->CheckType(3, GLua::Type::Table);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
-        }
+        // prepared statement already knows types of its params
+        auto options = state->param_options;
+        options.with_types = false;
 
-        state->query = std::make_shared<async_postgres::Query>(
-            async_postgres::PreparedCommand{
-                lua->GetString(2),
-                async_postgres::array_to_params(lua, 3),
-            });
+        auto query = async_postgres::acquire_query(state);
+        auto& command =
+            async_postgres::reuse_command<async_postgres::PreparedCommand>(
+                *query);
+        command.name.assign(lua->GetString(2));
+        async_postgres::array_to_params(lua, 3, options, command.param);
 
         if (lua->IsType(4, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 4);
+            query->callback = GLua::AutoReference(lua, 4);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
         return 0;
     }
 
@@ -136,19 +435,18 @@ namespace async_postgres::lua {
         lua->CheckType(2, GLua::Type::String);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
-        }
-
-        state->query = std::make_shared<async_postgres::Query>(
+        auto query = std::make_shared<async_postgres::Query>(
             async_postgres::DescribePreparedCommand{
                 lua->GetString(2),
             });
 
         if (lua->IsType(3, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 3);
+            query->callback = GLua::AutoReference(lua, 3);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
         return 0;
     }
 
@@ -157,19 +455,18 @@ namespace async_postgres::lua {
         lua->CheckType(2, GLua::Type::String);
 
         auto state = lua_connection_state();
-        if (state->query) {
-            throw std::runtime_error("query already in progress");
-        }
-
-        state->query = std::make_shared<async_postgres::Query>(
+        auto query = std::make_shared<async_postgres::Query>(
             async_postgres::DescribePortalCommand{
                 lua->GetString(2),
             });
 
         if (lua->IsType(3, GLua::Type::Function)) {
-            state->query->callback = GLua::AutoReference(lua, 3);
+            query->callback = GLua::AutoReference(lua, 3);
         }
 
+        async_postgres::apply_query_options(state, query.get());
+        async_postgres::submit_query(state, std::move(query));
+
         return 0;
     }
 
@@ -207,6 +504,42 @@ namespace async_postgres::lua {
         return 1;
     }
 
+    lua_protected_fn(listen) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+        lua->CheckType(3, GLua::Type::Function);
+
+        auto state = lua_connection_state();
+        std::string channel = lua->GetString(2);
+
+        auto [it, inserted] = state->listeners.try_emplace(channel);
+        it->second.callback = GLua::AutoReference(lua, 3);
+        it->second.coalesce =
+            lua->IsType(4, GLua::Type::Bool) && lua->GetBool(4);
+
+        if (inserted && !state->cache_channels.count(channel)) {
+            async_postgres::queue_listen(state, channel, true);
+        }
+
+        return 0;
+    }
+
+    lua_protected_fn(unlisten) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::String);
+
+        auto state = lua_connection_state();
+        std::string channel = lua->GetString(2);
+
+        // tags of cached results must stay listened
+        if (state->listeners.erase(channel) > 0 &&
+            !state->cache_channels.count(channel)) {
+            async_postgres::queue_listen(state, channel, false);
+        }
+
+        return 0;
+    }
+
     lua_protected_fn(setNoticeCallback) {
         lua->CheckType(1, async_postgres::connection_meta);
 
@@ -241,7 +574,10 @@ namespace async_postgres::lua {
                     break;
                 }
 
-                wait_for_socket(state->conn.get(), write, read);
+                // stores readiness of the socket for process_reset
+                if (!async_postgres::wait_for_socket({state})) {
+                    throw std::runtime_error("failed to poll connection");
+                }
                 process_reset(lua, state);
             }
 
@@ -249,18 +585,39 @@ namespace async_postgres::lua {
             return 1;
         }
 
-        if (state->query) {
-            auto query = state->query;
+        if (!state->queries.empty()) {
+            // queries which prepare statement might be inserted before
+            // the query, so it's waited until it leaves the queue
+            auto it = std::find_if(
+                state->queries.begin(), state->queries.end(),
+                [](const auto& query) { return !query->internal; });
+            auto query = it != state->queries.end() ? *it
+                                                    : state->queries.front();
+
+            while (std::find(state->queries.begin(), state->queries.end(),
+                             query) != state->queries.end()) {
+                // if query wasn't sent, send in through process_query
+                if (!state->queries.front()->sent) {
+                    async_postgres::process_query(lua, state);
+                    if (state->queries.empty() ||
+                        !state->queries.front()->sent) {
+                        break;
+                    }
+                    continue;
+                }
 
-            // if query wasn't sent, send in through process_query
-            if (!query->sent) {
-                async_postgres::process_query(lua, state);
-            }
+                if (async_postgres::copy_in_progress(state)) {
+                    // COPY IN waits for the socket to accept data,
+                    // COPY OUT waits for more data to arrive
+                    if (async_postgres::process_copy(lua, state, true)) {
+                        wait_for_socket(state->conn.get(), !state->flushed,
+                                        state->flushed);
+                    }
+                    continue;
+                }
 
-            // while query is the same and it's not done
-            while (query == state->query) {
-                async_postgres::process_result(lua, state,
-                                               pg::getResult(state->conn));
+                async_postgres::process_result(
+                    lua, state, async_postgres::get_result(state));
             }
 
             lua->PushBool(true);
@@ -271,18 +628,172 @@ namespace async_postgres::lua {
         return 1;
     }
 
+    // internal queries which are still waiting to be sent
+    // don't make connection busy
+    inline bool has_queries(async_postgres::Connection* state) {
+        return !state->cached_hits.empty() ||
+               std::any_of(
+            state->queries.begin(), state->queries.end(),
+            [](const auto& query) { return query->sent || !query->internal; });
+    }
+
+    inline bool connection_busy(async_postgres::Connection* state) {
+        return state->reset_event || has_queries(state);
+    }
+
+    inline void process_waited(GLua::ILuaInterface* lua,
+                               async_postgres::Connection* state) {
+        if (!state->conn) {
+            return;
+        }
+
+        async_postgres::check_query_timeout(lua, state);
+        if (!async_postgres::needs_processing(state)) {
+            return;
+        }
+
+        async_postgres::process_query(lua, state);
+        async_postgres::process_notifications(lua, state);
+        async_postgres::process_reset(lua, state);
+    }
+
+    // waits until all (or any) of the connections in the array at index 1
+    // have finished their queries and resets, timeout in milliseconds
+    // is taken from index 2, returns false if timeout has passed
+    inline bool wait_connections(GLua::ILuaInterface* lua, bool all) {
+        lua->CheckType(1, GLua::Type::Table);
+
+        int timeout = -1;
+        if (lua->IsType(2, GLua::Type::Number)) {
+            timeout = std::max<int>(lua->GetNumber(2), 0);
+        }
+        auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+        std::vector<async_postgres::Connection*> states;
+        int count = lua->ObjLen(1);
+        for (int i = 1; i <= count; i++) {
+            lua->PushNumber(i);
+            lua->GetTable(1);
+            auto state = lua->GetUserType<async_postgres::Connection>(
+                -1, async_postgres::connection_meta);
+            lua->Pop();
+
+            if (!state) {
+                throw std::runtime_error("expected array of PGconn");
+            }
+            states.push_back(state);
+        }
+
+        // queries which were added since last loop must be sent first,
+        // otherwise there is nothing to wait for on their sockets
+        async_postgres::begin_tick();
+        for (auto* state : states) {
+            if (connection_busy(state)) {
+                process_waited(lua, state);
+            }
+        }
+
+        std::vector<async_postgres::Connection*> busy;
+        while (true) {
+            busy.clear();
+            std::copy_if(states.begin(), states.end(), std::back_inserter(busy),
+                         connection_busy);
+            if (all ? busy.empty() : busy.size() < states.size()) {
+                return true;
+            }
+
+            int wait = -1;
+            if (timeout >= 0) {
+                auto left = deadline - Clock::now();
+                wait = std::chrono::ceil<std::chrono::milliseconds>(left)
+                           .count();
+                if (wait <= 0) {
+                    return false;
+                }
+            }
+
+            if (!async_postgres::wait_for_socket(busy, wait)) {
+                throw std::runtime_error("failed to poll connections");
+            }
+
+            // tick budget applies to every wakeup separately
+            async_postgres::begin_tick();
+            for (auto* state : busy) {
+                process_waited(lua, state);
+            }
+        }
+    }
+
+    lua_protected_fn(waitAll) {
+        lua->PushBool(wait_connections(lua, true));
+        return 1;
+    }
+
+    lua_protected_fn(waitAny) {
+        lua->PushBool(wait_connections(lua, false));
+        return 1;
+    }
+
     lua_protected_fn(isBusy) {
         lua->CheckType(1, async_postgres::connection_meta);
         auto state = lua_connection_state();
-        lua->PushBool(state->reset_event ||
-                      state->query);  // busy if reset or query are in progress
+        // busy if reset or query are in progress
+        lua->PushBool(connection_busy(state));
         return 1;
     }
 
     lua_protected_fn(querying) {
         lua->CheckType(1, async_postgres::connection_meta);
         auto state = lua_connection_state();
-        lua->PushBool(!!state->query);
+        lua->PushBool(has_queries(state));
+        return 1;
+    }
+
+    lua_protected_fn(pendingQueries) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(std::count_if(state->queries.begin(),
+                                      state->queries.end(),
+                                      [](const auto& query) {
+                                          return !query->sent &&
+                                                 !query->internal;
+                                      }));
+        return 1;
+    }
+
+    // pending queries together with sent ones
+    lua_protected_fn(outstandingQueries) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(std::count_if(state->queries.begin(),
+                                      state->queries.end(),
+                                      [](const auto& query) {
+                                          return query->sent ||
+                                                 !query->internal;
+                                      }));
+        return 1;
+    }
+
+    lua_protected_fn(clearQueries) {
+        lua->CheckType(1, async_postgres::connection_meta);
+
+        const char* error = "query was cancelled";
+        if (lua->IsType(2, GLua::Type::String)) {
+            error = lua->GetString(2);
+        }
+
+        auto state = lua_connection_state();
+        async_postgres::fail_pending_queries(lua, state, error);
+        return 0;
+    }
+
+    lua_protected_fn(cancel) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        // only running query can be cancelled
+        bool running = !state->reset_event && !state->queries.empty() &&
+                       state->queries.front()->sent;
+        lua->PushBool(running && async_postgres::request_cancel(state));
         return 1;
     }
 
@@ -307,6 +818,161 @@ namespace async_postgres::lua {
         lua->PushBool(state->array_result);
         return 1;
     }
+
+    lua_protected_fn(setBinaryResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        state->binary_result = lua->GetBool(2);
+        return 0;
+    }
+
+    lua_protected_fn(getBinaryResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->binary_result);
+        return 1;
+    }
+
+    lua_protected_fn(setLazyResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        state->lazy_result = lua->GetBool(2);
+        return 0;
+    }
+
+    lua_protected_fn(getLazyResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->lazy_result);
+        return 1;
+    }
+
+    lua_protected_fn(setColumnarResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        state->columnar_result = lua->GetBool(2);
+        return 0;
+    }
+
+    lua_protected_fn(getColumnarResult) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->columnar_result);
+        return 1;
+    }
+
+    lua_protected_fn(setStatementCache) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Number);
+        auto state = lua_connection_state();
+        async_postgres::set_statement_cache_size(
+            state, std::max<int>(lua->GetNumber(2), 0));
+        return 0;
+    }
+
+    lua_protected_fn(getStatementCache) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(state->statements.capacity);
+        lua->PushNumber(state->statements.entries.size());
+        return 2;
+    }
+
+    lua_protected_fn(setTypedParams) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        state->param_options.typed = lua->GetBool(2);
+        state->param_options.bytea =
+            lua->IsType(3, GLua::Type::Bool) && lua->GetBool(3);
+        return 0;
+    }
+
+    lua_protected_fn(getTypedParams) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->param_options.typed);
+        lua->PushBool(state->param_options.bytea);
+        return 2;
+    }
+
+    lua_protected_fn(setPinnedParams) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Number);
+        auto state = lua_connection_state();
+        state->param_options.pin_size = std::max<double>(lua->GetNumber(2), 0);
+        return 0;
+    }
+
+    lua_protected_fn(getPinnedParams) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(state->param_options.pin_size);
+        return 1;
+    }
+
+    lua_protected_fn(setQueryTimeout) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Number);
+        auto state = lua_connection_state();
+        state->query_timeout = std::max<int>(lua->GetNumber(2), 0);
+        return 0;
+    }
+
+    lua_protected_fn(getQueryTimeout) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(state->query_timeout);
+        return 1;
+    }
+
+    lua_protected_fn(setChunkSize) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Number);
+        auto state = lua_connection_state();
+        state->chunk_size = std::max<int>(lua->GetNumber(2), 0);
+        return 0;
+    }
+
+    lua_protected_fn(getChunkSize) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushNumber(state->chunk_size);
+        return 1;
+    }
+
+    lua_protected_fn(setThreadedIO) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        async_postgres::set_threaded_io(lua, state, lua->GetBool(2));
+        return 0;
+    }
+
+    lua_protected_fn(getThreadedIO) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->threaded);
+        return 1;
+    }
+
+    lua_protected_fn(setPipelineMode) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        lua->CheckType(2, GLua::Type::Bool);
+        auto state = lua_connection_state();
+        async_postgres::set_pipeline_mode(state, lua->GetBool(2));
+        return 0;
+    }
+
+    lua_protected_fn(getPipelineMode) {
+        lua->CheckType(1, async_postgres::connection_meta);
+        auto state = lua_connection_state();
+        lua->PushBool(state->pipeline);
+        return 1;
+    }
 }  // namespace async_postgres::lua
 
 #define register_lua_fn(name)                      \
@@ -322,6 +988,11 @@ void register_connection_mt(GLua::ILuaInterface* lua) {
     register_lua_fn(__gc);
     register_lua_fn(query);
     register_lua_fn(queryParams);
+    register_lua_fn(queryCached);
+    register_lua_fn(executeMany);
+    register_lua_fn(executeManyPrepared);
+    register_lua_fn(copyFrom);
+    register_lua_fn(copyToFile);
     register_lua_fn(prepare);
     register_lua_fn(queryPrepared);
     register_lua_fn(describePrepared);
@@ -329,14 +1000,43 @@ void register_connection_mt(GLua::ILuaInterface* lua) {
     register_lua_fn(reset);
     register_lua_fn(setNotifyCallback);
     register_lua_fn(getNotifyCallback);
+    register_lua_fn(listen);
+    register_lua_fn(unlisten);
     register_lua_fn(setNoticeCallback);
     register_lua_fn(getNoticeCallback);
     register_lua_fn(wait);
     register_lua_fn(isBusy);
     register_lua_fn(querying);
+    register_lua_fn(pendingQueries);
+    register_lua_fn(outstandingQueries);
+    register_lua_fn(clearQueries);
+    register_lua_fn(cancel);
     register_lua_fn(resetting);
     register_lua_fn(setArrayResult);
     register_lua_fn(getArrayResult);
+    register_lua_fn(setBinaryResult);
+    register_lua_fn(getBinaryResult);
+    register_lua_fn(setLazyResult);
+    register_lua_fn(getLazyResult);
+    register_lua_fn(setColumnarResult);
+    register_lua_fn(getColumnarResult);
+    register_lua_fn(setStatementCache);
+    register_lua_fn(getStatementCache);
+    register_lua_fn(setTypedParams);
+    register_lua_fn(getTypedParams);
+    register_lua_fn(setPinnedParams);
+    register_lua_fn(getPinnedParams);
+    register_lua_fn(setQueryTimeout);
+    register_lua_fn(getQueryTimeout);
+    register_lua_fn(setChunkSize);
+    register_lua_fn(getChunkSize);
+    register_lua_fn(setThreadedIO);
+    register_lua_fn(getThreadedIO);
+    register_lua_fn(setPipelineMode);
+    register_lua_fn(getPipelineMode);
+
+    lua->PushCFunction(async_postgres::lua::connectionStats);
+    lua->SetField(-2, "stats");
 
     async_postgres::register_misc_connection_functions(lua);
 
@@ -347,6 +1047,14 @@ void make_global_table(GLua::ILuaInterface* lua) {
     lua->CreateTable();
 
     register_lua_fn(connect);
+    register_lua_fn(setTickBudget);
+    register_lua_fn(getTickBudget);
+    register_lua_fn(setResultCacheSize);
+    register_lua_fn(resultCacheStats);
+    register_lua_fn(invalidateResultCache);
+    register_lua_fn(stats);
+    register_lua_fn(waitAll);
+    register_lua_fn(waitAny);
 
     async_postgres::register_enums(lua);
 
@@ -382,10 +1090,17 @@ GMOD_MODULE_OPEN() {
     auto lua = reinterpret_cast<GLua::ILuaInterface*>(LUA);
 
     register_connection_mt(lua);
+    async_postgres::register_result_mt(lua);
     make_global_table(lua);
     register_loop_hook(lua);
 
     return 0;
 }
 
-GMOD_MODULE_CLOSE() { return 0; }
+GMOD_MODULE_CLOSE() {
+    async_postgres::stop_worker();
+    async_postgres::stop_cancel_thread();
+    async_postgres::clear_result_cache();
+    async_postgres::close_poller();
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+Metrics async_postgres::global_metrics = {};
+
+// values below SUB_BUCKETS get their own buckets,
+// others are bucketed by highest bit and next two bits
+inline size_t bucket_index(uint64_t value) {
+    if (value < Histogram::SUB_BUCKETS) {
+        return value;
+    }
+
+    size_t msb = 0;
+    while (value >> (msb + 1)) {
+        msb++;
+    }
+
+    size_t sub = (value >> (msb - 2)) & (Histogram::SUB_BUCKETS - 1);
+    return (msb - 1) * Histogram::SUB_BUCKETS + sub;
+}
+
+inline uint64_t bucket_upper_bound(size_t index) {
+    if (index < Histogram::SUB_BUCKETS) {
+        return index;
+    }
+
+    size_t msb = index / Histogram::SUB_BUCKETS + 1;
+    size_t sub = index % Histogram::SUB_BUCKETS;
+    uint64_t lower = (Histogram::SUB_BUCKETS + sub) << (msb - 2);
+    return lower + (uint64_t(1) << (msb - 2)) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    buckets[std::min(bucket_index(value), BUCKETS - 1)]++;
+    count++;
+    sum += value;
+    max = std::max(max, value);
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p * count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            return std::min(bucket_upper_bound(i), max);
+        }
+    }
+    return max;
+}
+
+inline uint64_t microseconds(Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+        .count();
+}
+
+// every value is recorded both into connection and global metrics
+#define for_each_metrics(state) \
+    for (auto* metrics : {&(state)->metrics, &global_metrics})
+
+inline size_t params_size(const ParamValues& param) {
+    size_t size = 0;
+    for (int length : param.lengths) {
+        size += length;
+    }
+    return size;
+}
+
+#define get_if_command(type) \
+    const auto* command = std::get_if<type>(&query->command)
+
+inline size_t query_size(const Query* query) {
+    if (get_if_command(SimpleCommand)) {
+        return command->command.size();
+    } else if (get_if_command(ParameterizedCommand)) {
+        return command->command.size() + params_size(command->param);
+    } else if (get_if_command(CreatePreparedCommand)) {
+        return command->command.size();
+    } else if (get_if_command(PreparedCommand)) {
+        return params_size(command->param);
+    } else if (get_if_command(CachedCommand)) {
+        return params_size(command->param);
+    } else if (get_if_command(CopyFromCommand)) {
+        return command->command.size();
+    } else if (get_if_command(CopyToFileCommand)) {
+        return command->command.size();
+    } else if (get_if_command(ExecuteManyCommand)) {
+        size_t size = command->command.size();
+        for (const auto& param : command->params) {
+            size += params_size(param);
+        }
+        return size;
+    }
+    return 0;
+}
+
+// size of values in bigger results is estimated from this many rows
+constexpr int RESULT_SIZE_SAMPLE_ROWS = 32;
+
+// size of values in the result, rows of big results are sampled,
+// so metrics don't walk over every value
+inline size_t result_size(const PGresult* result) {
+    int nTuples = PQntuples(result);
+    int nFields = PQnfields(result);
+    int step = std::max(nTuples / RESULT_SIZE_SAMPLE_ROWS, 1);
+
+    size_t size = 0;
+    int sampled = 0;
+    for (int i = 0; i < nTuples; i += step, sampled++) {
+        for (int j = 0; j < nFields; j++) {
+            size += PQgetlength(result, i, j);
+        }
+    }
+    return sampled > 0 ? size * nTuples / sampled : 0;
+}
+
+void async_postgres::record_queue_depth(Connection* state) {
+    // internal queries are rare, so they are counted
+    // only if queue might be deeper than before
+    uint64_t depth = state->queries.size();
+    if (depth <= state->metrics.queue_depth_max &&
+        depth <= global_metrics.queue_depth_max) {
+        return;
+    }
+
+    depth = std::count_if(state->queries.begin(), state->queries.end(),
+                          [](const auto& query) { return !query->internal; });
+    for_each_metrics(state) {
+        metrics->queue_depth_max = std::max(metrics->queue_depth_max, depth);
+    }
+}
+
+void async_postgres::record_sent(Connection* state, Query* query) {
+    query->sent_at = Clock::now();
+    if (query->internal) {
+        return;
+    }
+
+    auto waited = microseconds(query->sent_at - query->submitted);
+    auto size = query_size(query);
+    for_each_metrics(state) {
+        metrics->queue_time.record(waited);
+        metrics->bytes_sent += size;
+    }
+}
+
+void async_postgres::record_result(Connection* state, Query* query,
+                                   const PGresult* result) {
+    if (query->internal) {
+        return;
+    }
+
+    if (!query->has_result) {
+        query->has_result = true;
+
+        auto waited = microseconds(Clock::now() - query->sent_at);
+        for_each_metrics(state) { metrics->first_result_time.record(waited); }
+    }
+
+    if (!result) {
+        return;
+    }
+
+    uint64_t rows = PQntuples(result);
+    uint64_t memory = PQresultMemorySize(result);
+    uint64_t size = result_size(result);
+    for_each_metrics(state) {
+        metrics->rows += rows;
+        metrics->result_memory += memory;
+        metrics->bytes_received += size;
+    }
+}
+
+void async_postgres::record_completed(Connection* state, Query* query) {
+    if (query->internal) {
+        return;
+    }
+
+    auto total = microseconds(Clock::now() - query->submitted);
+    for_each_metrics(state) {
+        metrics->total_time.record(total);
+        metrics->queries++;
+    }
+}
+
+void async_postgres::record_callback(Connection* state,
+                                     Clock::time_point started) {
+    auto elapsed = microseconds(Clock::now() - started);
+    for_each_metrics(state) { metrics->callback_time.record(elapsed); }
+}
+
+void async_postgres::record_bytes_sent(Connection* state, size_t bytes) {
+    for_each_metrics(state) { metrics->bytes_sent += bytes; }
+}
+
+void async_postgres::record_bytes_received(Connection* state, size_t bytes) {
+    for_each_metrics(state) { metrics->bytes_received += bytes; }
+}
+
+// pushes histogram summary, values are in microseconds
+inline void create_histogram_table(GLua::ILuaInterface* lua,
+                                   const Histogram& histogram) {
+    lua->CreateTable();
+
+    lua->PushNumber(histogram.count);
+    lua->SetField(-2, "count");
+
+    lua->PushNumber(histogram.count > 0
+                        ? double(histogram.sum) / histogram.count
+                        : 0.0);
+    lua->SetField(-2, "mean");
+
+    lua->PushNumber(histogram.percentile(0.5));
+    lua->SetField(-2, "p50");
+
+    lua->PushNumber(histogram.percentile(0.9));
+    lua->SetField(-2, "p90");
+
+    lua->PushNumber(histogram.percentile(0.99));
+    lua->SetField(-2, "p99");
+
+    lua->PushNumber(histogram.max);
+    lua->SetField(-2, "max");
+}
+
+void async_postgres::create_metrics_table(GLua::ILuaInterface* lua,
+                                          const Metrics& metrics) {
+    lua->CreateTable();
+
+    create_histogram_table(lua, metrics.queue_time);
+    lua->SetField(-2, "queue_time");
+
+    create_histogram_table(lua, metrics.first_result_time);
+    lua->SetField(-2, "first_result_time");
+
+    create_histogram_table(lua, metrics.total_time);
+    lua->SetField(-2, "total_time");
+
+    create_histogram_table(lua, metrics.callback_time);
+    lua->SetField(-2, "callback_time");
+
+    lua->PushNumber(metrics.queries);
+    lua->SetField(-2, "queries");
+
+    lua->PushNumber(metrics.queue_depth_max);
+    lua->SetField(-2, "queue_depth_max");
+
+    lua->PushNumber(metrics.bytes_sent);
+    lua->SetField(-2, "bytes_sent");
+
+    lua->PushNumber(metrics.bytes_received);
+    lua->SetField(-2, "bytes_received");
+
+    lua->PushNumber(metrics.result_memory);
+    lua->SetField(-2, "result_memory");
+
+    lua->PushNumber(metrics.rows);
+    lua->SetField(-2, "rows");
+}
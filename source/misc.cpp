@@ -10,9 +10,13 @@ using namespace async_postgres;
 
 #define lua_connection() lua_connection_state()->conn.get()
 
+// worker thread might be using the connection at the same time
+#define lua_connection_lock() ConnectionLock lock(lua_connection_state())
+
 #define lua_string_getter(name, getter)            \
     lua_protected_fn(name) {                       \
         lua->CheckType(1, connection_meta);        \
+        lua_connection_lock();                     \
         lua->PushString(getter(lua_connection())); \
         return 1;                                  \
     }
@@ -20,6 +24,7 @@ using namespace async_postgres;
 #define lua_number_getter(name, getter)            \
     lua_protected_fn(name) {                       \
         lua->CheckType(1, connection_meta);        \
+        lua_connection_lock();                     \
         lua->PushNumber(getter(lua_connection())); \
         return 1;                                  \
     }
@@ -27,6 +32,7 @@ using namespace async_postgres;
 #define lua_bool_getter(name, getter)            \
     lua_protected_fn(name) {                     \
         lua->CheckType(1, connection_meta);      \
+        lua_connection_lock();                   \
         lua->PushBool(getter(lua_connection())); \
         return 1;                                \
     }
@@ -44,6 +50,7 @@ namespace async_postgres::lua {
     lua_protected_fn(parameterStatus) {
         lua->CheckType(1, connection_meta);
         lua->CheckType(2, GLua::Type::String);
+        lua_connection_lock();
 
         lua->PushString(PQparameterStatus(lua_connection(), lua->GetString(2)));
         return 1;
@@ -58,6 +65,7 @@ namespace async_postgres::lua {
     lua_protected_fn(sslAttribute) {
         lua->CheckType(1, connection_meta);
         lua->CheckType(2, GLua::Type::String);
+        lua_connection_lock();
 
         lua->PushString(PQsslAttribute(lua_connection(), lua->GetString(2)));
         return 1;
@@ -65,6 +73,7 @@ namespace async_postgres::lua {
 
     lua_protected_fn(clientEncoding) {
         lua->CheckType(1, connection_meta);
+        lua_connection_lock();
         lua->PushString(
             pg_encoding_to_char(PQclientEncoding(lua_connection())));
         return 1;
@@ -73,6 +82,7 @@ namespace async_postgres::lua {
     lua_protected_fn(setClientEncoding) {
         lua->CheckType(1, connection_meta);
         lua->CheckType(2, GLua::Type::String);
+        lua_connection_lock();
 
         lua->PushBool(
             PQsetClientEncoding(lua_connection(), lua->GetString(2)) == 0);
@@ -84,6 +94,7 @@ namespace async_postgres::lua {
         lua->CheckType(2, GLua::Type::String);
         lua->CheckType(3, GLua::Type::String);
         lua->CheckType(4, GLua::Type::String);
+        lua_connection_lock();
 
         auto result =
             PQencryptPasswordConn(lua_connection(), lua->GetString(2),
@@ -97,6 +108,7 @@ namespace async_postgres::lua {
     lua_protected_fn(escape) {
         lua->CheckType(1, connection_meta);
         lua->CheckType(2, GLua::Type::String);
+        lua_connection_lock();
 
         auto str = get_string(lua, 2);
         auto escaped =
@@ -114,6 +126,7 @@ namespace async_postgres::lua {
     lua_protected_fn(escapeIdentifier) {
         lua->CheckType(1, connection_meta);
         lua->CheckType(2, GLua::Type::String);
+        lua_connection_lock();
 
         auto str = get_string(lua, 2);
         auto escaped =
@@ -140,6 +153,7 @@ namespace async_postgres::lua {
             reinterpret_cast<char*>(PQescapeBytea(str, strLen, &outLen));
 
         if (!escaped) {
+            lua_connection_lock();
             throw std::runtime_error(PQerrorMessage(lua_connection()));
         }
 
@@ -160,6 +174,7 @@ namespace async_postgres::lua {
             reinterpret_cast<char*>(PQunescapeBytea(str, &outLen));
 
         if (!unescaped) {
+            lua_connection_lock();
             throw std::runtime_error(PQerrorMessage(lua_connection()));
         }
 
@@ -1,27 +1,200 @@
+#include <unordered_set>
+
 #include "async_postgres.hpp"
 
 using namespace async_postgres;
 
+// notifications of one listened channel received in this tick
+struct NotifyBatch {
+    std::string channel;
+    std::vector<std::string> payloads;
+    // used only by coalescing listeners
+    std::unordered_set<std::string> seen;
+};
+
+using NotifyBatches = std::vector<NotifyBatch>;
+
+inline void deliver_notify(GLua::ILuaInterface* lua, Connection* state,
+                           const pg::notify& notify) {
+    if (state->on_notify.Push()) {
+        lua->PushString(notify->relname);  // arg 1 channel name
+        lua->PushString(notify->extra);    // arg 2 payload
+        lua->PushNumber(notify->be_pid);   // arg 3 backend pid
+
+        pcall(lua, 3, 0);
+    }
+}
+
+// notifications of listened channels are batched until the end of the tick,
+// others are passed to on_notify rightaway
+inline void route_notify(GLua::ILuaInterface* lua, Connection* state,
+                         NotifyBatches& batches, const pg::notify& notify) {
+    // channels are used as tags of cached results
+    invalidate_cached_results(notify->relname);
+
+    auto listener = state->listeners.find(notify->relname);
+    if (listener == state->listeners.end()) {
+        return deliver_notify(lua, state, notify);
+    }
+
+    auto batch = std::find_if(
+        batches.begin(), batches.end(),
+        [&](const auto& batch) { return batch.channel == notify->relname; });
+    if (batch == batches.end()) {
+        batch = batches.insert(batches.end(), {notify->relname, {}, {}});
+    }
+
+    if (listener->second.coalesce &&
+        !batch->seen.insert(notify->extra).second) {
+        return;
+    }
+    batch->payloads.emplace_back(notify->extra);
+}
+
+inline void deliver_batches(GLua::ILuaInterface* lua, Connection* state,
+                            const NotifyBatches& batches) {
+    for (const auto& batch : batches) {
+        // previous callbacks might have removed the listener
+        auto listener = state->listeners.find(batch.channel);
+        if (listener == state->listeners.end() ||
+            !listener->second.callback.Push()) {
+            continue;
+        }
+
+        lua->PushString(batch.channel.c_str());
+
+        lua->CreateTable();
+        for (size_t i = 0; i < batch.payloads.size(); i++) {
+            lua->PushNumber(i + 1);
+            lua->PushString(batch.payloads[i].c_str(),
+                            batch.payloads[i].size());
+            lua->SetTable(-3);
+        }
+
+        pcall(lua, 2, 0);
+    }
+}
+
+// notifications and notices which were received by the worker thread
+inline void process_worker_notifications(GLua::ILuaInterface* lua,
+                                         Connection* state) {
+    auto& worker = *state->worker;
+
+    Notice* notice_ptr;
+    while (worker.notices.pop(notice_ptr)) {
+        std::unique_ptr<Notice> notice(notice_ptr);
+        if (state->on_notice.Push()) {
+            lua->PushString(notice->message.c_str());
+            create_notice_error_table(lua, *notice);
+            pcall(lua, 2, 0);
+        }
+    }
+
+    NotifyBatches batches;
+    PGnotify* notify;
+    while (worker.notifications.pop(notify)) {
+        route_notify(lua, state, batches, pg::notify(notify, &PQfreemem));
+    }
+    deliver_batches(lua, state, batches);
+}
+
+// rows of streaming query must stay in the socket until lua handles
+// previous ones, otherwise input can be read while queries are running
+inline bool can_consume_input(Connection* state) {
+    return state->queries.empty() || !state->queries.front()->sent ||
+           state->queries.front()->chunk_size == 0;
+}
+
+// notifications and notices which were left by detached worker
+inline void process_detached_notifications(GLua::ILuaInterface* lua,
+                                           Connection* state) {
+    while (!state->detached_notices.empty()) {
+        auto notice = std::move(state->detached_notices.front());
+        state->detached_notices.pop_front();
+        if (state->on_notice.Push()) {
+            lua->PushString(notice->message.c_str());
+            create_notice_error_table(lua, *notice);
+            pcall(lua, 2, 0);
+        }
+    }
+
+    NotifyBatches batches;
+    while (!state->detached_notifications.empty()) {
+        auto notify = std::move(state->detached_notifications.front());
+        state->detached_notifications.pop_front();
+        route_notify(lua, state, batches, notify);
+    }
+    deliver_batches(lua, state, batches);
+}
+
 void async_postgres::process_notifications(GLua::ILuaInterface* lua,
                                            Connection* state) {
-    if (!state->on_notify) {
-        return;
+    if (!state->detached_notices.empty() ||
+        !state->detached_notifications.empty()) {
+        process_detached_notifications(lua, state);
+    }
+
+    if (state->worker) {
+        return process_worker_notifications(lua, state);
     }
 
-    if (!state->query && check_socket_status(state->conn.get()).read_ready &&
-        PQconsumeInput(state->conn.get()) == 0) {
-        // we consumed input
-        // but there was some error
+    if (!state->on_notify && state->listeners.empty() &&
+        !result_cache_enabled()) {
         return;
     }
 
+    if (state->socket.read_ready && can_consume_input(state)) {
+        state->socket.read_ready = false;
+        if (PQconsumeInput(state->conn.get()) == 0) {
+            // we consumed input
+            // but there was some error
+            return;
+        }
+    }
+
+    NotifyBatches batches;
     while (auto notify = pg::getNotify(state->conn)) {
-        if (state->on_notify.Push()) {
-            lua->PushString(notify->relname);  // arg 1 channel name
-            lua->PushString(notify->extra);    // arg 2 payload
-            lua->PushNumber(notify->be_pid);   // arg 3 backend pid
+        route_notify(lua, state, batches, notify);
+    }
+    deliver_batches(lua, state, batches);
+}
+
+inline std::shared_ptr<Query> listen_query(Connection* state,
+                                           const std::string& channel,
+                                           bool listen) {
+    auto conn = state->conn.get();
+    ConnectionLock lock(state);
+    char* escaped = PQescapeIdentifier(conn, channel.c_str(), channel.size());
+    if (!escaped) {
+        throw std::runtime_error(PQerrorMessage(conn));
+    }
 
-            pcall(lua, 3, 0);
+    std::string command = listen ? "LISTEN " : "UNLISTEN ";
+    command += escaped;
+    PQfreemem(escaped);
+
+    auto query = std::make_shared<Query>(SimpleCommand{std::move(command)});
+    query->internal = true;
+    return query;
+}
+
+void async_postgres::queue_listen(Connection* state, const std::string& channel,
+                                  bool listen) {
+    state->queries.push_back(listen_query(state, channel, listen));
+}
+
+void async_postgres::restore_listeners(Connection* state) {
+    std::vector<std::shared_ptr<Query>> queries;
+    for (const auto& [channel, listener] : state->listeners) {
+        queries.push_back(listen_query(state, channel, true));
+    }
+    for (const auto& channel : state->cache_channels) {
+        if (!state->listeners.count(channel)) {
+            queries.push_back(listen_query(state, channel, true));
         }
     }
+
+    // after reset every query is waiting to be sent
+    state->queries.insert(state->queries.begin(), queries.begin(),
+                          queries.end());
 }
@@ -0,0 +1,227 @@
+#include <Platform.hpp>
+
+#include "async_postgres.hpp"
+
+#if SYSTEM_IS_LINUX
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#elif SYSTEM_IS_WINDOWS
+#include <WinSock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+using namespace async_postgres;
+
+// sockets are registered only while main thread polls them,
+// connections which are owned by worker are skipped
+inline int watched_socket(Connection* state) {
+    if (state->worker) {
+        return -1;
+    }
+    return PQsocket(state->conn.get());
+}
+
+// write readiness is needed only while there is data to flush,
+// otherwise socket would be always reported as ready
+inline bool watches_write(Connection* state) {
+    if (state->reset_event) {
+        return state->reset_event->status == PGRES_POLLING_WRITING;
+    }
+    return !state->flushed;
+}
+
+// every registered socket, including ones of pending connections
+std::vector<PollRegistration*> watched;
+
+inline void update_registration(Connection* state) {
+    int fd = watched_socket(state);
+    watch_socket(state->registration, fd, fd >= 0 && watches_write(state));
+
+    // reset without socket fails on the next poll
+    if (fd < 0 && state->reset_event) {
+        state->socket.failed = true;
+    }
+}
+
+inline void forget_registration(PollRegistration& registration) {
+    if (registration.fd >= 0) {
+        watched.erase(
+            std::find(watched.begin(), watched.end(), &registration));
+    }
+    registration.fd = -1;
+    registration.write = false;
+}
+
+#if SYSTEM_IS_LINUX
+int epoll_fd = -1;
+std::vector<epoll_event> epoll_events;
+
+void async_postgres::watch_socket(PollRegistration& registration, int fd,
+                                  bool write) {
+    if (fd == registration.fd && write == registration.write) {
+        return;
+    }
+
+    unwatch_socket(registration);
+    if (fd < 0) {
+        return;
+    }
+
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            throw std::runtime_error("failed to create epoll instance");
+        }
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    if (write) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = &registration;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 &&
+        (errno != EEXIST ||
+         epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) != 0)) {
+        // socket will be checked again next time
+        return;
+    }
+
+    registration.fd = fd;
+    registration.write = write;
+    watched.push_back(&registration);
+}
+
+void async_postgres::unwatch_socket(PollRegistration& registration) {
+    if (registration.fd >= 0 && epoll_fd >= 0) {
+        // fails if socket was already closed, which also unregisters it
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, registration.fd, nullptr);
+    }
+    forget_registration(registration);
+}
+
+void async_postgres::poll_connections() {
+    for (auto* state : connections) {
+        state->socket = {};
+        update_registration(state);
+    }
+
+    if (watched.empty()) {
+        return;
+    }
+
+    for (auto* registration : watched) {
+        *registration->status = {};
+    }
+
+    // sockets are level-triggered, so every ready socket
+    // is reported again until it's drained
+    epoll_events.resize(watched.size());
+    int count = epoll_wait(epoll_fd, epoll_events.data(),
+                           epoll_events.size(), 0);
+    for (int i = 0; i < count; i++) {
+        auto& event = epoll_events[i];
+        auto& socket =
+            *static_cast<PollRegistration*>(event.data.ptr)->status;
+        socket.read_ready = event.events & EPOLLIN;
+        socket.write_ready = event.events & EPOLLOUT;
+        socket.failed = event.events & (EPOLLERR | EPOLLHUP);
+    }
+}
+
+void async_postgres::close_poller() {
+    while (!watched.empty()) {
+        forget_registration(*watched.back());
+    }
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+#else
+// there is no epoll, but all sockets still can be checked with one poll call
+std::vector<pollfd> poll_fds;
+
+void async_postgres::watch_socket(PollRegistration& registration, int fd,
+                                  bool write) {
+    if (fd == registration.fd && write == registration.write) {
+        return;
+    }
+
+    unwatch_socket(registration);
+    if (fd < 0) {
+        return;
+    }
+
+    registration.fd = fd;
+    registration.write = write;
+    watched.push_back(&registration);
+}
+
+void async_postgres::unwatch_socket(PollRegistration& registration) {
+    forget_registration(registration);
+}
+
+void async_postgres::poll_connections() {
+    for (auto* state : connections) {
+        state->socket = {};
+        update_registration(state);
+    }
+
+    poll_fds.clear();
+    for (auto* registration : watched) {
+        *registration->status = {};
+
+        short events = POLLIN | (registration->write ? POLLOUT : 0);
+        poll_fds.push_back(
+            {static_cast<decltype(pollfd::fd)>(registration->fd), events, 0});
+    }
+
+    if (poll_fds.empty() || poll(poll_fds.data(), poll_fds.size(), 0) <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < poll_fds.size(); i++) {
+        auto revents = poll_fds[i].revents;
+        auto& socket = *watched[i]->status;
+        socket.read_ready = revents & POLLIN;
+        socket.write_ready = revents & POLLOUT;
+        socket.failed = revents & (POLLERR | POLLHUP | POLLNVAL);
+    }
+}
+
+void async_postgres::close_poller() {
+    while (!watched.empty()) {
+        forget_registration(*watched.back());
+    }
+}
+#endif
+
+bool async_postgres::needs_processing(Connection* state) {
+    // worker is polled by other means
+    if (state->worker || state->held_result || !state->cached_hits.empty()) {
+        return true;
+    }
+
+    auto& socket = state->socket;
+    if (socket.read_ready || socket.write_ready || socket.failed) {
+        return true;
+    }
+
+    // reset can continue only when socket is ready
+    if (state->reset_event) {
+        return false;
+    }
+
+    // queries which were added since last loop,
+    // or results which are already buffered by libpq
+    // (queries waiting to be sent are always at the back)
+    return !state->queries.empty() &&
+           (!state->queries.back()->sent || !pg::isBusy(state->conn));
+}
@@ -1,52 +1,231 @@
+#include <Platform.hpp>
+
+#include <cstdlib>
+#include <thread>
+
 #include "async_postgres.hpp"
 
+#if SYSTEM_IS_WINDOWS
+#include <WinSock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#define SOCKET int
+#endif
+
 using namespace async_postgres;
 
 #define get_if_command(type) \
     const auto* command = std::get_if<type>(&query->command)
 
+// outside of pipeline mode connection enters it only for this command,
+// and leaves it after sync result is received
+// executions which were queued before a failure can't be taken back,
+// so caller must reset the connection, otherwise they would be synced
+// with the next query (params are checked beforehand, so that happens
+// only if connection is broken or out of memory)
+inline bool send_execute_many(PGconn* conn, const ExecuteManyCommand& command,
+                              bool binary_result, bool pipeline) {
+    if (!pipeline && PQenterPipelineMode(conn) == 0) {
+        return false;
+    }
+
+    // SQL is parsed once, as unnamed statement
+    const char* name = command.prepared ? command.command.c_str() : "";
+    bool ok = command.prepared ||
+              PQsendPrepare(conn, "", command.command.c_str(), 0, nullptr) == 1;
+
+    for (const auto& param : command.params) {
+        if (!ok) {
+            break;
+        }
+        ok = PQsendQueryPrepared(conn, name, param.length(),
+                                 param.values.data(), param.lengths.data(),
+                                 param.formats.data(),
+                                 binary_result ? 1 : 0) == 1;
+    }
+
+    return ok && PQpipelineSync(conn) == 1;
+}
+
+// executeMany sends its own sync after all executions
+inline bool needs_sync(const Query* query) {
+    return !std::holds_alternative<ExecuteManyCommand>(query->command);
+}
+
 // returns true if query was sent
 // returns false on error
-inline bool send_query(PGconn* conn, Query* query) {
+bool async_postgres::send_query(PGconn* conn, Query* query, bool pipeline) {
     if (get_if_command(SimpleCommand)) {
+        if (pipeline) {
+            // simple query protocol is not allowed in pipeline mode
+            return PQsendQueryParams(conn, command->command.c_str(), 0,
+                                     nullptr, nullptr, nullptr, nullptr,
+                                     0) == 1;
+        }
         return PQsendQuery(conn, command->command.c_str()) == 1;
     } else if (get_if_command(ParameterizedCommand)) {
         return PQsendQueryParams(conn, command->command.c_str(),
-                                 command->param.length(), nullptr,
+                                 command->param.length(),
+                                 command->param.types.data(),
                                  command->param.values.data(),
                                  command->param.lengths.data(),
-                                 command->param.formats.data(), 0) == 1;
+                                 command->param.formats.data(),
+                                 query->binary_result ? 1 : 0) == 1;
     } else if (get_if_command(CreatePreparedCommand)) {
         return PQsendPrepare(conn, command->name.c_str(),
-                             command->command.c_str(), 0, nullptr) == 1;
+                             command->command.c_str(), command->types.size(),
+                             command->types.data()) == 1;
     } else if (get_if_command(PreparedCommand)) {
         return PQsendQueryPrepared(
                    conn, command->name.c_str(), command->param.length(),
                    command->param.values.data(), command->param.lengths.data(),
-                   command->param.formats.data(), 0) == 1;
+                   command->param.formats.data(),
+                   query->binary_result ? 1 : 0) == 1;
+    } else if (get_if_command(CachedCommand)) {
+        return PQsendQueryPrepared(
+                   conn, command->name.c_str(), command->param.length(),
+                   command->param.values.data(), command->param.lengths.data(),
+                   command->param.formats.data(),
+                   query->binary_result ? 1 : 0) == 1;
     } else if (get_if_command(DescribePreparedCommand)) {
         return PQsendDescribePrepared(conn, command->name.c_str()) == 1;
     } else if (get_if_command(DescribePortalCommand)) {
         return PQsendDescribePortal(conn, command->name.c_str()) == 1;
+    } else if (get_if_command(CopyFromCommand)) {
+        return PQsendQuery(conn, command->command.c_str()) == 1;
+    } else if (get_if_command(CopyToFileCommand)) {
+        return PQsendQuery(conn, command->command.c_str()) == 1;
+    } else if (get_if_command(ExecuteManyCommand)) {
+        return send_execute_many(conn, *command, query->binary_result,
+                                 pipeline);
     }
     return false;
 }
 
+// calls function on the stack and records how long it took
+inline void call_callback(GLua::ILuaInterface* lua, Connection* state,
+                          int nargs) {
+    auto started = Clock::now();
+    pcall(lua, nargs, 0);
+    record_callback(state, started);
+}
+
+// params buffers bigger than this aren't kept by retired queries
+constexpr size_t MAX_RETIRED_ARENA = 64 * 1024;
+
+inline void release_params(ParamValues& param) {
+    param.resize(0);
+    if (param.arena.capacity() > MAX_RETIRED_ARENA) {
+        param.arena.shrink_to_fit();
+    }
+}
+
+// completed queries are kept for reuse, so steady stream of queries
+// doesn't allocate new queries and buffers for their params
+inline void retire_query(Connection* state, std::shared_ptr<Query>&& query) {
+    if (state->retired_queries.size() >= MAX_RETIRED_QUERIES) {
+        return;
+    }
+
+    auto& command = query->command;
+    if (auto params = std::get_if<ParameterizedCommand>(&command)) {
+        release_params(params->param);
+    } else if (auto prepared = std::get_if<PreparedCommand>(&command)) {
+        release_params(prepared->param);
+    } else if (auto cached = std::get_if<CachedCommand>(&command)) {
+        release_params(cached->param);
+    } else if (!std::holds_alternative<SimpleCommand>(command)) {
+        return;
+    }
+
+    // pool must not keep lua values and results alive
+    query->callback.Free();
+    query->array_result = false;
+    query->binary_result = false;
+    query->lazy_result = false;
+    query->columnar_result = false;
+    query->sent = false;
+    query->internal = false;
+    query->timeout = 0;
+    query->timed_out = false;
+    query->cancel.reset();
+    query->has_result = false;
+    query->chunk_size = 0;
+    query->rows.clear();
+    query->rows_count = 0;
+    query->cache.reset();
+
+    state->retired_queries.push_back(std::move(query));
+}
+
+std::shared_ptr<Query> async_postgres::acquire_query(Connection* state) {
+    // query which is still referenced (e.g. its callback is running)
+    // can't be reused yet
+    auto it = std::find_if(
+        state->retired_queries.begin(), state->retired_queries.end(),
+        [](const auto& query) { return query.use_count() == 1; });
+    if (it == state->retired_queries.end()) {
+        return std::make_shared<Query>(SimpleCommand{});
+    }
+
+    auto query = std::move(*it);
+    *it = std::move(state->retired_queries.back());
+    state->retired_queries.pop_back();
+
+    // state of the previous use was reset when query was retired
+    query->submitted = Clock::now();
+    return query;
+}
+
+void async_postgres::apply_query_options(Connection* state, Query* query) {
+    query->array_result = state->array_result;
+    query->binary_result = state->binary_result;
+    query->lazy_result = state->lazy_result;
+    query->columnar_result = state->columnar_result;
+    query->timeout = state->query_timeout;
+
+    // COPY, executeMany and cached queries need whole results
+    const auto& command = query->command;
+    bool streaming = !query->cache &&
+                     !std::holds_alternative<CopyFromCommand>(command) &&
+                     !std::holds_alternative<CopyToFileCommand>(command) &&
+                     !std::holds_alternative<ExecuteManyCommand>(command);
+    query->chunk_size = streaming ? state->chunk_size : 0;
+}
+
+void async_postgres::submit_query(Connection* state,
+                                  std::shared_ptr<Query>&& query) {
+    state->queries.push_back(std::move(query));
+    record_queue_depth(state);
+}
+
+// removes completed query from the front of the queue,
+// it's retired by the caller after its callback was called
+inline std::shared_ptr<Query> complete_query(Connection* state) {
+    auto query = std::move(state->queries.front());
+    state->queries.pop_front();
+    record_completed(state, query.get());
+    return query;
+}
+
 // This function will remove the query from the connection state
 // and call the callback with the error message
-void query_failed(GLua::ILuaInterface* lua, Connection* state) {
-    if (!state->query) {
+void query_failed(GLua::ILuaInterface* lua, Connection* state,
+                  std::shared_ptr<Query> query, const char* error) {
+    auto it = std::find(state->queries.begin(), state->queries.end(), query);
+    if (it == state->queries.end()) {
         return;
     }
 
-    auto query = state->query;
-    state->query.reset();
+    state->queries.erase(it);
 
     if (query->callback.Push()) {
         lua->PushBool(false);
-        lua->PushString(PQerrorMessage(state->conn.get()));
-        pcall(lua, 2, 0);
+        lua->PushString(error);
+        call_callback(lua, state, 2);
     }
+    retire_query(state, std::move(query));
 }
 
 inline bool bad_result(PGresult* result) {
@@ -57,109 +236,669 @@ inline bool bad_result(PGresult* result) {
     auto status = PQresultStatus(result);
 
     return status == PGRES_BAD_RESPONSE || status == PGRES_NONFATAL_ERROR ||
-           status == PGRES_FATAL_ERROR;
+           status == PGRES_FATAL_ERROR || status == PGRES_PIPELINE_ABORTED;
+}
+
+// query cancelled because of timeout fails with its own error,
+// instead of the server one
+inline const char* result_error(const Query& query, const PGresult* result) {
+    bool cancelled = query.cancel && query.cancel->succeeded;
+    return cancelled ? "query timed out" : PQresultErrorMessage(result);
+}
+
+// fails queries which were going to use statement that wasn't prepared,
+// otherwise they would try to prepare it again and again
+inline void fail_unprepared_queries(GLua::ILuaInterface* lua,
+                                    Connection* state, const std::string& name,
+                                    const char* error) {
+    std::string message = error;
+    for (size_t i = 0; i < state->queries.size();) {
+        auto query = state->queries[i];
+        auto command = std::get_if<CachedCommand>(&query->command);
+        if (!query->sent && command && command->name == name) {
+            query_failed(lua, state, query, message.c_str());
+        } else {
+            i++;
+        }
+    }
 }
 
-void query_result(GLua::ILuaInterface* lua, pg::result&& result,
-                  GLua::AutoReference& callback, bool array_result) {
-    if (callback.Push()) {
-        if (!bad_result(result.get())) {
+void query_result(GLua::ILuaInterface* lua, Connection* state,
+                  pg::result&& result, Query& query) {
+    // cache must not refer to statement which wasn't created
+    auto prepare = std::get_if<CreatePreparedCommand>(&query.command);
+    if (prepare && bad_result(result.get())) {
+        invalidate_cached_statement(state, prepare->name);
+        fail_unprepared_queries(lua, state, prepare->name,
+                                PQresultErrorMessage(result.get()));
+    }
+
+    record_result(state, &query, result.get());
+
+    if (query.cache && !bad_result(result.get())) {
+        store_cached_result(*query.cache, result.get());
+    }
+
+    if (query.callback.Push()) {
+        auto copy = std::get_if<CopyToFileCommand>(&query.command);
+        if (copy && !copy->error.empty()) {
+            lua->PushBool(false);
+            lua->PushString(copy->error.c_str());
+            call_callback(lua, state, 2);
+        } else if (!bad_result(result.get())) {
             lua->PushBool(true);
-            create_result_table(lua, result.get(), array_result);
-            pcall(lua, 2, 0);
+            if (copy) {
+                create_copy_result_table(lua, result.get(), *copy);
+            } else if (query.lazy_result) {
+                create_lazy_result(lua, std::move(result), query.array_result);
+            } else {
+                create_result_table(lua, result.get(), query.array_result,
+                                    query.columnar_result);
+            }
+            call_callback(lua, state, 2);
         } else {
             lua->PushBool(false);
-            lua->PushString(PQresultErrorMessage(result.get()));
+            lua->PushString(result_error(query, result.get()));
             create_result_error_table(lua, result.get());
-            pcall(lua, 3, 0);
+            call_callback(lua, state, 3);
+        }
+    }
+}
+
+inline bool is_row_result(const PGresult* result) {
+    if (!result) {
+        return false;
+    }
+
+    auto status = PQresultStatus(result);
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    if (status == PGRES_TUPLES_CHUNK) {
+        return true;
+    }
+#endif
+    return status == PGRES_SINGLE_TUPLE;
+}
+
+void async_postgres::set_row_mode(PGconn* conn,
+                                  [[maybe_unused]] int chunk_size) {
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    if (chunk_size > 1) {
+        PQsetChunkedRowsMode(conn, chunk_size);
+        return;
+    }
+#endif
+    // if row mode can't be set, whole result will be delivered at once
+    PQsetSingleRowMode(conn);
+}
+
+// delivers rows which were accumulated by streaming query
+void flush_rows(GLua::ILuaInterface* lua, Connection* state, Query* query) {
+    if (query->rows.empty()) {
+        return;
+    }
+
+    auto rows = std::move(query->rows);
+    query->rows.clear();
+    query->rows_count = 0;
+
+    if (query->callback.Push()) {
+        lua->PushBool(true);
+        create_chunk_table(lua, rows, query->array_result,
+                           query->columnar_result);
+        call_callback(lua, state, 2);
+    }
+}
+
+// accumulates rows of streaming query
+// returns true if chunk was delivered to the callback
+inline bool stream_rows(GLua::ILuaInterface* lua, Connection* state,
+                        Query* query, pg::result&& result) {
+    record_result(state, query, result.get());
+    query->rows_count += PQntuples(result.get());
+    query->rows.push_back(std::move(result));
+
+    if (query->rows_count >= query->chunk_size) {
+        flush_rows(lua, state, query);
+        return true;
+    }
+    return false;
+}
+
+inline bool has_sent_query(Connection* state) {
+    return !state->queries.empty() && state->queries.front()->sent;
+}
+
+inline ExecuteManyCommand* sent_execute_many(Connection* state) {
+    if (!has_sent_query(state)) {
+        return nullptr;
+    }
+    return std::get_if<ExecuteManyCommand>(&state->queries.front()->command);
+}
+
+// executeMany uses pipeline mode even if connection isn't in it
+inline bool in_pipeline(Connection* state) {
+    return state->pipeline || sent_execute_many(state);
+}
+
+inline void add_execute_many_result(ExecuteManyCommand& many,
+                                    pg::result&& result) {
+    // without prepared statement first result is of the preparation
+    size_t index = many.prepared ? many.results + 1 : many.results;
+    many.results++;
+
+    if (bad_result(result.get())) {
+        if (!many.error) {
+            many.error = std::move(result);
+            many.error_index = index;
+        }
+        return;
+    }
+
+    many.affected += std::strtoull(PQcmdTuples(result.get()), nullptr, 10);
+}
+
+inline void create_execute_many_table(GLua::ILuaInterface* lua,
+                                      const ExecuteManyCommand& many) {
+    lua->CreateTable();
+
+    lua->PushNumber(many.affected);
+    lua->SetField(-2, "affected");
+
+    lua->PushNumber(many.params.size());
+    lua->SetField(-2, "count");
+}
+
+// called when sync result of executeMany is received
+inline void finish_execute_many(GLua::ILuaInterface* lua, Connection* state) {
+    if (!state->pipeline) {
+        PQexitPipelineMode(state->conn.get());
+    }
+    auto query = complete_query(state);
+
+    if (!query->callback.Push()) {
+        return;
+    }
+
+    auto& many = std::get<ExecuteManyCommand>(query->command);
+    if (!many.error) {
+        lua->PushBool(true);
+        create_execute_many_table(lua, many);
+        call_callback(lua, state, 2);
+    } else {
+        lua->PushBool(false);
+        lua->PushString(result_error(*query, many.error.get()));
+        create_result_error_table(lua, many.error.get());
+        if (many.error_index > 0) {
+            lua->PushNumber(many.error_index);
+            lua->SetField(-2, "index");
+        }
+        call_callback(lua, state, 3);
+    }
+}
+
+// cancel request which is still on its way would hit the next query
+inline bool cancel_in_flight(Connection* state) {
+    return state->cancel_request && !state->cancel_request->done;
+}
+
+bool async_postgres::can_send_queries(Connection* state) {
+    auto& queries = state->queries;
+    if (queries.empty() || queries.back()->sent || cancel_in_flight(state)) {
+        return false;
+    }
+
+    // without pipeline mode only the front query can be sent
+    return state->pipeline || !queries.front()->sent;
+}
+
+// sends queries which weren't sent yet,
+// without pipeline mode only the front query can be sent
+inline void send_pending_queries(GLua::ILuaInterface* lua,
+                                 Connection* state) {
+    if (cancel_in_flight(state)) {
+        return;
+    }
+
+    // worker thread will send queries by itself
+    if (state->worker) {
+        for (size_t i = 0; i < state->queries.size(); i++) {
+            if (!state->queries[i]->sent) {
+                prepare_cached_statement(state, i);
+
+                auto& query = state->queries[i];
+                if (!state->worker->submissions.push(query.get())) {
+                    break;
+                }
+                query->sent = true;
+                record_sent(state, query.get());
+            }
         }
+        return;
+    }
+
+    auto conn = state->conn.get();
+    bool sent = false;
+
+    for (size_t i = 0; i < state->queries.size();) {
+        if (state->queries[i]->sent) {
+            i++;
+            continue;
+        }
+
+        if (!state->pipeline && i > 0) {
+            break;
+        }
+
+        // might insert queries which prepare the statement before this one
+        prepare_cached_statement(state, i);
+        auto query = state->queries[i];
+
+        // in pipeline mode every query gets its own sync point,
+        // so error in one query won't abort the following ones
+        if (!send_query(conn, query.get(), state->pipeline) ||
+            (state->pipeline && needs_sync(query.get()) &&
+             PQpipelineSync(conn) == 0)) {
+            // query_failed removes query from the list
+            query_failed(lua, state, query, PQerrorMessage(conn));
+
+            // partially sent batch of executeMany must not reach the server
+            if (!needs_sync(query.get())) {
+                reset(lua, state, {});
+                return;
+            }
+            continue;
+        }
+
+        // row mode must be set right after query was sent, in pipeline mode
+        // it applies to the oldest query, so only first query can stream
+        if (query->chunk_size > 0 && (!state->pipeline || i == 0)) {
+            set_row_mode(conn, query->chunk_size);
+        }
+
+        query->sent = true;
+        record_sent(state, query.get());
+        sent = true;
+        i++;
+    }
+
+    if (sent) {
+        state->flushed = PQflush(conn) == 0;
     }
 }
 
 // returns true if poll was successful
 // returns false if there was an error
-inline bool poll_query(PGconn* conn, Query* query) {
-    auto socket = check_socket_status(conn);
+inline bool poll_query(Connection* state) {
+    if (state->worker) {
+        return true;
+    }
+
+    auto conn = state->conn.get();
+    auto& socket = state->socket;
     if (socket.read_ready || socket.write_ready) {
-        if (socket.read_ready && PQconsumeInput(conn) == 0) {
-            return false;
+        // don't read from socket while there are results to process,
+        // so streaming queries won't buffer rows faster than lua handles them
+        if (socket.read_ready && pg::isBusy(state->conn)) {
+            // socket is drained until next poll
+            socket.read_ready = false;
+            if (PQconsumeInput(conn) == 0) {
+                return false;
+            }
         }
 
-        if (!query->flushed) {
-            query->flushed = PQflush(conn) == 0;
+        if (!state->flushed) {
+            state->flushed = PQflush(conn) == 0;
         }
     }
     return true;
 }
 
+// in pipeline mode results of every query are followed by NULL
+// and then by PGRES_PIPELINE_SYNC result, query is done only after sync
+// returns true if chunk of rows was delivered and processing should stop
+inline bool process_pipeline_result(GLua::ILuaInterface* lua,
+                                    Connection* state, pg::result&& result) {
+    if (!result) {
+        std::string error;
+        bool broken;
+        {
+            ConnectionLock lock(state);
+            broken = PQstatus(state->conn.get()) == CONNECTION_BAD;
+            error = PQerrorMessage(state->conn.get());
+        }
+
+        // connection was lost, sync results will never arrive
+        if (broken) {
+            fail_sent_queries(lua, state, error.c_str());
+        }
+        return false;
+    }
+
+    if (!has_sent_query(state)) {
+        return false;
+    }
+
+    if (PQresultStatus(result.get()) == PGRES_PIPELINE_SYNC) {
+        if (sent_execute_many(state)) {
+            finish_execute_many(lua, state);
+        } else {
+            retire_query(state, complete_query(state));
+        }
+        return false;
+    }
+
+    auto query = state->queries.front();
+    if (auto many = sent_execute_many(state)) {
+        record_result(state, query.get(), result.get());
+        add_execute_many_result(*many, std::move(result));
+        return false;
+    }
+    if (is_row_result(result.get())) {
+        return stream_rows(lua, state, query.get(), std::move(result));
+    }
+
+    flush_rows(lua, state, query.get());
+    query_result(lua, state, std::move(result), *query);
+    return false;
+}
+
 void async_postgres::process_result(GLua::ILuaInterface* lua, Connection* state,
                                     pg::result&& result) {
+    if (in_pipeline(state)) {
+        if (process_pipeline_result(lua, state, std::move(result))) {
+            return;
+        }
+
+        // process every result which is already available
+        while (has_sent_query(state) && result_ready(state) &&
+               !tick_budget_exceeded()) {
+            if (process_pipeline_result(lua, state,
+                                        get_result(state))) {
+                return;
+            }
+        }
+
+        // callbacks might added new queries, send them rightaway
+        return process_query(lua, state);
+    }
+
+    // COPY data is handled by process_copy, final result will follow it
+    if (result && start_copy(state, result.get())) {
+        return process_query(lua, state);
+    }
+
+    // rows of streaming query, only one chunk is delivered per call
+    // other rows will wait in the socket until next time
+    if (is_row_result(result.get()) && has_sent_query(state)) {
+        auto query = state->queries.front();
+        while (is_row_result(result.get())) {
+            if (stream_rows(lua, state, query.get(), std::move(result)) ||
+                !result_ready(state)) {
+                return;
+            }
+
+            result = get_result(state);
+        }
+    }
+
     // query is done
     if (!result) {
-        state->query.reset();
+        if (!state->queries.empty()) {
+            retire_query(state, complete_query(state));
+        }
         return process_query(lua, state);
     }
 
+    // deliver rows which are left from streaming query
+    auto query = state->queries.front();
+    flush_rows(lua, state, query.get());
+
     // next result might be empty,
     // that means that query is done
     // and we need to remove query from the state
     // so callback can add another query
-    if (!pg::isBusy(state->conn)) {
-        auto next_result = pg::getResult(state->conn);
+    if (result_ready(state)) {
+        auto next_result = get_result(state);
         if (!next_result) {
             // query is done, we need to remove query from the state
-            auto query = state->query;
-            state->query.reset();
+            complete_query(state);
 
-            query_result(lua, std::move(result), query->callback,
-                         state->array_result);
+            query_result(lua, state, std::move(result), *query);
+            retire_query(state, std::move(query));
 
             // callback might added another query, process it rightaway
             process_query(lua, state);
         } else {
             // query is not done, but also since we own next result
             // we need to call query callback and process next result
-            query_result(lua, std::move(result), state->query->callback,
-                         state->array_result);
+            query_result(lua, state, std::move(result), *query);
+
+            // next result waits for the next tick, if time is over
+            if (tick_budget_exceeded()) {
+                state->held_result = std::move(next_result);
+                return;
+            }
             process_result(lua, state, std::move(next_result));
         }
     } else {
         // query is not done, but we don't need to process next result
-        query_result(lua, std::move(result), state->query->callback,
-                     state->array_result);
+        query_result(lua, state, std::move(result), *query);
+    }
+}
+
+// cache hits are delivered even while connection is busy or resetting
+inline void deliver_cached_hits(GLua::ILuaInterface* lua, Connection* state) {
+    // hits added by callbacks wait for the next loop
+    auto hits = std::move(state->cached_hits);
+    state->cached_hits.clear();
+
+    for (auto& hit : hits) {
+        if (!hit.callback.Push()) {
+            continue;
+        }
+
+        if (!hit.lazy_result) {
+            lua->PushBool(true);
+            create_result_table(lua, hit.result.get(), hit.array_result,
+                                hit.columnar_result);
+            call_callback(lua, state, 2);
+            continue;
+        }
+
+        // lazy result owns its PGresult, cached one is shared
+        pg::result copy(PQcopyResult(hit.result.get(),
+                                     PG_COPYRES_ATTRS | PG_COPYRES_TUPLES),
+                        &PQclear);
+        lua->PushBool(!!copy);
+        if (copy) {
+            create_lazy_result(lua, std::move(copy), hit.array_result);
+        } else {
+            lua->PushString("failed to copy cached result");
+        }
+        call_callback(lua, state, 2);
     }
 }
 
 void async_postgres::process_query(GLua::ILuaInterface* lua,
                                    Connection* state) {
-    if (!state->query) {
+    if (!state->cached_hits.empty()) {
+        deliver_cached_hits(lua, state);
+    }
+
+    if (state->queries.empty() || state->reset_event) {
         // no queries to process
         // don't process queries while reconnecting
         return;
     }
 
-    auto* query = state->query.get();
-    if (!query->sent) {
-        if (!send_query(state->conn.get(), query)) {
-            query_failed(lua, state);
-            return process_query(lua, state);
-        }
-
-        query->sent = true;
-        query->flushed = PQflush(state->conn.get()) == 0;
+    send_pending_queries(lua, state);
+    if (!has_sent_query(state)) {
+        // every query failed to send
+        return;
     }
 
-    // if (!poll_query(state->conn.get(), query)) {
+    // if (!poll_query(state)) {
     //     query_failed(lua, state);
     //     return process_query(lua, state);
     // }
 
     // probably failed poll should not result
     // in query failure
-    poll_query(state->conn.get(), query);
+    poll_query(state);
+
+    // results will arrive only after all COPY data is sent
+    if (process_copy(lua, state)) {
+        return;
+    }
+
+    // results which are left will be processed in the next tick
+    if (tick_budget_exceeded()) {
+        return;
+    }
 
     // ensure that getting result won't block
-    if (!pg::isBusy(state->conn)) {
-        return process_result(lua, state, pg::getResult(state->conn));
+    if (result_ready(state)) {
+        return process_result(lua, state, get_result(state));
+    }
+}
+
+void async_postgres::fail_sent_queries(GLua::ILuaInterface* lua,
+                                       Connection* state, const char* error) {
+    // copy error message, since callbacks might overwrite it
+    std::string message = error;
+
+    // worker must not touch queries which are going to be removed
+    detach_worker(state);
+    state->held_result.reset();
+
+    while (has_sent_query(state)) {
+        query_failed(lua, state, state->queries.front(), message.c_str());
+    }
+
+    // reset attaches worker by itself when it's finished
+    if (state->threaded && !state->reset_event) {
+        attach_worker(state);
+    }
+}
+
+void async_postgres::fail_pending_queries(GLua::ILuaInterface* lua,
+                                          Connection* state,
+                                          const char* error) {
+    std::string message = error;
+
+    // remove queries first, so callbacks can add new ones
+    auto it = std::find_if(state->queries.begin(), state->queries.end(),
+                           [](const auto& query) { return !query->sent; });
+    std::vector<std::shared_ptr<Query>> pending(it, state->queries.end());
+    state->queries.erase(it, state->queries.end());
+
+    for (auto& query : pending) {
+        if (query->callback.Push()) {
+            lua->PushBool(false);
+            lua->PushString(message.c_str());
+            call_callback(lua, state, 2);
+        }
+        retire_query(state, std::move(query));
+    }
+}
+
+void async_postgres::set_pipeline_mode(Connection* state, bool enabled) {
+    if (state->pipeline == enabled) {
+        return;
+    }
+
+    if (has_sent_query(state)) {
+        throw std::runtime_error(
+            "pipeline mode can't be changed while queries are in progress");
+    }
+
+    // pipeline mode will be entered after reset is finished
+    if (!state->reset_event) {
+        // connection can't be used while worker owns it
+        bool threaded = !!state->worker;
+        detach_worker(state);
+
+        auto conn = state->conn.get();
+        int ok = enabled ? PQenterPipelineMode(conn) : PQexitPipelineMode(conn);
+
+        if (threaded) {
+            attach_worker(state);
+        }
+
+        if (ok == 0) {
+            throw std::runtime_error(PQerrorMessage(conn));
+        }
+    }
+
+    state->pipeline = enabled;
+}
+
+// worker receives results by itself, so they can be checked only
+// by waking up periodically
+constexpr int WORKER_WAIT_INTERVAL = 1;
+
+bool async_postgres::wait_for_socket(const std::vector<Connection*>& states,
+                                     int timeout) {
+    std::vector<pollfd> fds;
+    std::vector<Connection*> polled;
+
+    for (auto* state : states) {
+        state->socket = {};
+
+        // cache hits are delivered without waiting for the socket
+        if (!state->cached_hits.empty()) {
+            timeout = 0;
+        }
+
+        if (state->worker) {
+            if (timeout < 0 || timeout > WORKER_WAIT_INTERVAL) {
+                timeout = WORKER_WAIT_INTERVAL;
+            }
+            continue;
+        }
+
+        SOCKET fd = PQsocket(state->conn.get());
+        if (fd < 0) {
+            // reset without socket will fail rightaway
+            if (state->reset_event) {
+                state->socket.failed = true;
+                timeout = 0;
+            }
+            continue;
+        }
+
+        short events = POLLIN;
+        if (state->reset_event) {
+            if (state->reset_event->status == PGRES_POLLING_WRITING) {
+                events = POLLOUT;
+            }
+        } else if (!state->flushed || can_send_queries(state)) {
+            events |= POLLOUT;
+        }
+
+        fds.push_back({fd, events, 0});
+        polled.push_back(state);
+    }
+
+    // poll can't be called without sockets on windows
+    if (fds.empty()) {
+        if (timeout > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        }
+        return timeout >= 0;
+    }
+
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+        return false;
     }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        auto revents = fds[i].revents;
+        auto& socket = polled[i]->socket;
+        socket.read_ready = revents & POLLIN;
+        socket.write_ready = revents & POLLOUT;
+        socket.failed = revents & (POLLERR | POLLHUP | POLLNVAL);
+    }
+
+    return true;
 }
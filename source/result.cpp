@@ -1,67 +1,620 @@
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <tuple>
 #include <vector>
 
+#include <libpq-events.h>
+
 #include "async_postgres.hpp"
 
+// Value of the cell converted to lua type, but not pushed yet,
+// so it can be decoded outside of the main thread
+struct Cell {
+    enum Kind : std::uint8_t { Null, Number, Bool, String, ArenaString };
+
+    Kind kind = Null;
+    int length = 0;
+    union {
+        double number;
+        bool boolean;
+        // points into the PGresult, which owns the value
+        const char* string;
+        // offset in the arena, for strings which were made by decoder
+        size_t offset;
+    };
+};
+
+inline void set_string(Cell& cell, const char* value, int length) {
+    cell.kind = Cell::String;
+    cell.string = value;
+    cell.length = length;
+}
+
+inline void set_number(Cell& cell, double number) {
+    cell.kind = Cell::Number;
+    cell.number = number;
+}
+
+// copies string made by decoder into the arena
+inline void set_arena_string(Cell& cell, std::vector<char>& arena,
+                             std::string_view value) {
+    cell.kind = Cell::ArenaString;
+    cell.offset = arena.size();
+    cell.length = value.size();
+    arena.insert(arena.end(), value.begin(), value.end());
+}
+
+// integers above it can't be represented by double exactly
+constexpr std::int64_t MAX_SAFE_INTEGER = std::int64_t(1) << 53;
+
+// Decodes binary value of a specific type
+typedef void (*ValueDecoder)(Cell& cell, const char* value, int length,
+                             std::vector<char>& arena);
+
 struct FieldInfo {
     const char* name;
     bool text;
     Oid type;
+    ValueDecoder decoder;
 };
 
-void async_postgres::create_result_table(GLua::ILuaInterface* lua,
-                                         PGresult* result, bool array_result) {
-    lua->CreateTable();
+// values in binary format are sent in network byte order
+template <typename T>
+inline T read_be(const char* value) {
+    std::uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        result = (result << 8) | static_cast<unsigned char>(value[i]);
+    }
+    return static_cast<T>(result);
+}
 
-    std::vector<FieldInfo> fields;
+template <typename T>
+inline T read_be_float(const char* value) {
+    using U = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+    U bits = read_be<U>(value);
+    T result;
+    std::memcpy(&result, &bits, sizeof(T));
+    return result;
+}
 
-    // Fields metadata
-    lua->CreateTable();
+template <typename T>
+void decode_int(Cell& cell, const char* value, int length,
+                std::vector<char>&) {
+    if (length != sizeof(T)) {
+        return set_string(cell, value, length);
+    }
+    set_number(cell, static_cast<double>(read_be<T>(value)));
+}
+
+template <typename T>
+void decode_float(Cell& cell, const char* value, int length,
+                  std::vector<char>&) {
+    if (length != sizeof(T)) {
+        return set_string(cell, value, length);
+    }
+    set_number(cell, static_cast<double>(read_be_float<T>(value)));
+}
+
+// int8 which doesn't fit into double is pushed as string,
+// same as it would be in text format
+void decode_int8(Cell& cell, const char* value, int length,
+                 std::vector<char>& arena) {
+    if (length != 8) {
+        return set_string(cell, value, length);
+    }
+
+    auto number = read_be<std::int64_t>(value);
+    if (number >= -MAX_SAFE_INTEGER && number <= MAX_SAFE_INTEGER) {
+        return set_number(cell, static_cast<double>(number));
+    }
+
+    char text[24];
+    auto end = std::to_chars(text, text + sizeof(text), number).ptr;
+    set_arena_string(cell, arena, {text, size_t(end - text)});
+}
+
+void decode_bool(Cell& cell, const char* value, int length,
+                 std::vector<char>&) {
+    cell.kind = Cell::Bool;
+    cell.boolean = length > 0 && value[0] != 0;
+}
+
+// 2000-01-01 in unix time, postgres epoch
+constexpr double POSTGRES_EPOCH = 946684800.0;
+
+// timestamp and timestamptz are microseconds since postgres epoch
+void decode_timestamp(Cell& cell, const char* value, int length,
+                      std::vector<char>&) {
+    if (length != 8) {
+        return set_string(cell, value, length);
+    }
+
+    auto time = read_be<std::int64_t>(value);
+    if (time == std::numeric_limits<std::int64_t>::max()) {
+        set_number(cell, HUGE_VAL);
+    } else if (time == std::numeric_limits<std::int64_t>::min()) {
+        set_number(cell, -HUGE_VAL);
+    } else {
+        set_number(cell, POSTGRES_EPOCH + static_cast<double>(time) / 1e6);
+    }
+}
+
+// powers of 10 which are exactly representable by double
+constexpr double EXACT_POWERS_OF_10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+constexpr int MAX_EXACT_POWER_OF_10 = 22;
+
+// formats numeric like numeric_out in postgres does
+inline void set_numeric_string(Cell& cell, std::vector<char>& arena,
+                               const char* value, bool negative) {
+    auto ndigits = read_be<std::int16_t>(value);
+    auto weight = read_be<std::int16_t>(value + 2);
+    auto dscale = read_be<std::int16_t>(value + 6);
+    auto digit = [&](int i) {
+        return i >= 0 && i < ndigits ? read_be<std::int16_t>(value + 8 + i * 2)
+                                     : 0;
+    };
+
+    std::string text;
+    if (negative) {
+        text += '-';
+    }
+
+    char group[8];
+    if (weight < 0) {
+        text += '0';
+    }
+    for (int i = 0; i <= weight; i++) {
+        // first group is written without leading zeros
+        std::snprintf(group, sizeof(group), i == 0 ? "%d" : "%04d", digit(i));
+        text += group;
+    }
+
+    if (dscale > 0) {
+        text += '.';
+        size_t end = text.size() + dscale;
+        for (int i = weight + 1; text.size() < end; i++) {
+            std::snprintf(group, sizeof(group), "%04d", digit(i));
+            text += group;
+        }
+        text.resize(end);
+    }
+
+    set_arena_string(cell, arena, text);
+}
+
+// numeric is sent as base 10000 digits, see numeric_send in postgres
+// values which can't be converted to double exactly are pushed as strings,
+// otherwise conversion gives the same number as tonumber of its text
+void decode_numeric(Cell& cell, const char* value, int length,
+                    std::vector<char>& arena) {
+    if (length < 8) {
+        return set_string(cell, value, length);
+    }
+
+    auto ndigits = read_be<std::int16_t>(value);
+    auto weight = read_be<std::int16_t>(value + 2);
+    auto sign = read_be<std::uint16_t>(value + 4);
+    if (ndigits < 0 || length < 8 + ndigits * 2) {
+        return set_string(cell, value, length);
+    }
+
+    switch (sign) {
+        case 0xC000:  // NaN
+            return set_number(cell, std::numeric_limits<double>::quiet_NaN());
+        case 0xD000:  // +Infinity
+            return set_number(cell, HUGE_VAL);
+        case 0xF000:  // -Infinity
+            return set_number(cell, -HUGE_VAL);
+    }
+
+    bool negative = sign == 0x4000;
+
+    // more than 4 groups always have more significant digits
+    // than double can hold
+    if (ndigits > 4) {
+        return set_numeric_string(cell, arena, value, negative);
+    }
+
+    // value is mantissa * 10^exponent
+    std::uint64_t mantissa = 0;
+    for (int i = 0; i < ndigits; i++) {
+        mantissa = mantissa * 10000 + read_be<std::int16_t>(value + 8 + i * 2);
+    }
+    int exponent = (weight - ndigits + 1) * 4;
+    while (mantissa != 0 && mantissa % 10 == 0) {
+        mantissa /= 10;
+        exponent++;
+    }
+
+    if (mantissa > MAX_SAFE_INTEGER ||
+        std::abs(exponent) > MAX_EXACT_POWER_OF_10) {
+        return set_numeric_string(cell, arena, value, negative);
+    }
+
+    // both operands are exact, so result is correctly rounded
+    double result = static_cast<double>(mantissa);
+    if (exponent >= 0) {
+        result *= EXACT_POWERS_OF_10[exponent];
+    } else {
+        result /= EXACT_POWERS_OF_10[-exponent];
+    }
+
+    set_number(cell, negative ? -result : result);
+}
+
+void decode_uuid(Cell& cell, const char* value, int length,
+                 std::vector<char>& arena) {
+    if (length != 16) {
+        return set_string(cell, value, length);
+    }
+
+    cell.kind = Cell::ArenaString;
+    cell.offset = arena.size();
+    cell.length = 36;
+    arena.resize(arena.size() + 36);
+
+    static const char hex[] = "0123456789abcdef";
+    char* uuid = arena.data() + cell.offset;
+    int pos = 0;
+    for (int i = 0; i < 16; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            uuid[pos++] = '-';
+        }
+        auto byte = static_cast<unsigned char>(value[i]);
+        uuid[pos++] = hex[byte >> 4];
+        uuid[pos++] = hex[byte & 0xF];
+    }
+}
+
+struct TypeDecoder {
+    Oid type;
+    ValueDecoder decoder;
+};
+
+// Oids are taken from catalog/pg_type_d.h
+// types which are not listed here are pushed as raw bytes
+constexpr TypeDecoder type_decoders[] = {
+    {16, decode_bool},                    // bool
+    {20, decode_int8},                    // int8
+    {21, decode_int<std::int16_t>},       // int2
+    {23, decode_int<std::int32_t>},       // int4
+    {26, decode_int<std::uint32_t>},      // oid
+    {700, decode_float<float>},           // float4
+    {701, decode_float<double>},          // float8
+    {1114, decode_timestamp},             // timestamp
+    {1184, decode_timestamp},             // timestamptz
+    {1700, decode_numeric},               // numeric
+    {2950, decode_uuid},                  // uuid
+};
+
+inline ValueDecoder find_decoder(Oid type) {
+    for (const auto& entry : type_decoders) {
+        if (entry.type == type) {
+            return entry.decoder;
+        }
+    }
+    return nullptr;
+}
+
+inline FieldInfo get_field_info(const PGresult* result, int column) {
+    FieldInfo info = {PQfname(result, column), PQfformat(result, column) == 0,
+                      PQftype(result, column), nullptr};
+    if (!info.text) {
+        info.decoder = find_decoder(info.type);
+    }
+    return info;
+}
+
+std::vector<FieldInfo> get_fields(const PGresult* result) {
+    std::vector<FieldInfo> fields;
     int nFields = PQnfields(result);
     for (int i = 0; i < nFields; i++) {
-        lua->PushNumber(i + 1);
+        fields.push_back(get_field_info(result, i));
+    }
+    return fields;
+}
 
-        FieldInfo info = {PQfname(result, i), PQfformat(result, i) == 0,
-                          PQftype(result, i)};
+void push_fields_table(GLua::ILuaInterface* lua,
+                       const std::vector<FieldInfo>& fields) {
+    lua->CreateTable();
+    for (size_t i = 0; i < fields.size(); i++) {
+        lua->PushNumber(i + 1);
 
         lua->CreateTable();
-        lua->PushString(info.name);
+        lua->PushString(fields[i].name);
         lua->SetField(-2, "name");
 
-        lua->PushNumber(info.type);
+        lua->PushNumber(fields[i].type);
         lua->SetField(-2, "type");
 
         lua->SetTable(-3);
-        fields.push_back(info);
     }
+}
+
+// creates fields metadata table in the table on top of the stack
+std::vector<FieldInfo> create_fields_table(GLua::ILuaInterface* lua,
+                                           const PGresult* result) {
+    auto fields = get_fields(result);
+    push_fields_table(lua, fields);
     lua->SetField(-2, "fields");
+    return fields;
+}
 
-    // Rows
-    lua->CreateTable();
-    int nTuples = PQntuples(result);
-    for (int i = 0; i < nTuples; i++) {
+inline void decode_cell(Cell& cell, const PGresult* result, int row,
+                        int column, const FieldInfo& field,
+                        std::vector<char>& arena) {
+    auto value = PQgetvalue(result, row, column);
+    auto length = PQgetlength(result, row, column);
+    if (field.decoder) {
+        field.decoder(cell, value, length, arena);
+    } else {
+        set_string(cell, value, length);
+    }
+}
+
+// pushes decoded cell, cell must not be NULL
+inline void push_cell(GLua::ILuaInterface* lua, const Cell& cell,
+                      const char* arena) {
+    switch (cell.kind) {
+        case Cell::Number:
+            return lua->PushNumber(cell.number);
+        case Cell::Bool:
+            return lua->PushBool(cell.boolean);
+        case Cell::String:
+            return lua->PushString(cell.string, cell.length);
+        case Cell::ArenaString:
+            return lua->PushString(arena + cell.offset, cell.length);
+        case Cell::Null:
+            return lua->PushNil();
+    }
+}
+
+// pushes value of the cell, value must not be NULL
+inline void push_value(GLua::ILuaInterface* lua, const PGresult* result,
+                       int row, int column, const FieldInfo& field) {
+    // only main thread pushes values, so arena can be shared
+    static std::vector<char> arena;
+    arena.clear();
+
+    Cell cell;
+    decode_cell(cell, result, row, column, field, arena);
+    push_cell(lua, cell, arena.data());
+}
+
+// result decoded by the worker thread, so main thread only has to
+// push values, it's attached to the PGresult as instance data
+struct DecodedResult {
+    int rows;
+    int columns;
+    // cells of every row one after another
+    std::vector<Cell> cells;
+    // strings made by decoders
+    std::vector<char> arena;
+
+    inline const Cell& cell(int row, int column) const {
+        return cells[row * columns + column];
+    }
+};
+
+// frees decoded result together with the PGresult
+static int decoded_result_event(PGEventId id, void* info, void*) {
+    if (id == PGEVT_RESULTDESTROY) {
+        auto event = static_cast<PGEventResultDestroy*>(info);
+        delete static_cast<DecodedResult*>(
+            PQresultInstanceData(event->result, decoded_result_event));
+    }
+    return 1;
+}
+
+inline const DecodedResult* get_decoded_result(const PGresult* result) {
+    return static_cast<const DecodedResult*>(
+        PQresultInstanceData(result, decoded_result_event));
+}
+
+void async_postgres::register_result_events(PGconn* conn) {
+    // fails if it's already registered, which is fine
+    PQregisterEventProc(conn, decoded_result_event, "async_postgres", nullptr);
+}
+
+void async_postgres::decode_result(PGresult* result) {
+    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+        return;
+    }
+
+    auto fields = get_fields(result);
+    auto decoded = std::make_unique<DecodedResult>();
+    decoded->rows = PQntuples(result);
+    decoded->columns = fields.size();
+    decoded->cells.resize(decoded->rows * decoded->columns);
+
+    for (int i = 0; i < decoded->rows; i++) {
+        for (int j = 0; j < decoded->columns; j++) {
+            if (!PQgetisnull(result, i, j)) {
+                decode_cell(decoded->cells[i * decoded->columns + j], result,
+                            i, j, fields[j], decoded->arena);
+            }
+        }
+    }
+
+    // fails if connection didn't register the event
+    if (PQresultSetInstanceData(result, decoded_result_event, decoded.get())) {
+        decoded.release();
+    }
+}
+
+// appends decoded rows into the table on top of the stack
+void add_decoded_rows(GLua::ILuaInterface* lua, const DecodedResult& decoded,
+                      const std::vector<FieldInfo>& fields,
+                      bool array_result) {
+    int rows = lua->Top();
+
+    // field names are pushed once and copied for every row,
+    // so strings aren't created and hashed again for every cell
+    int keys = rows + 1;
+    if (!array_result) {
+        for (int j = 0; j < decoded.columns; j++) {
+            lua->PushString(fields[j].name);
+        }
+    }
+
+    for (int i = 0; i < decoded.rows; i++) {
         lua->PushNumber(i + 1);
         lua->CreateTable();
-        for (int j = 0; j < nFields; j++) {
+        for (int j = 0; j < decoded.columns; j++) {
             // skip NULL values
-            if (!PQgetisnull(result, i, j)) {
-                // field name
-                if (!array_result) {
-                    lua->PushString(fields[j].name);
-                } else {
-                    lua->PushNumber(j + 1);
-                }
+            const auto& cell = decoded.cell(i, j);
+            if (cell.kind == Cell::Null) {
+                continue;
+            }
 
-                // field value
-                lua->PushString(PQgetvalue(result, i, j),
-                                PQgetlength(result, i, j));
+            if (!array_result) {
+                lua->Push(keys + j);
+            } else {
+                lua->PushNumber(j + 1);
+            }
+            push_cell(lua, cell, decoded.arena.data());
+            lua->SetTable(-3);
+        }
+        lua->SetTable(rows);
+    }
+
+    if (!array_result) {
+        lua->Pop(decoded.columns);
+    }
+}
+
+// same as create_columns_table, but for decoded result
+void create_decoded_columns_table(GLua::ILuaInterface* lua,
+                                  const DecodedResult& decoded,
+                                  const std::vector<FieldInfo>& fields,
+                                  bool array_result) {
+    lua->CreateTable();
+    for (int j = 0; j < decoded.columns; j++) {
+        if (!array_result) {
+            lua->PushString(fields[j].name);
+        } else {
+            lua->PushNumber(j + 1);
+        }
 
+        lua->CreateTable();
+        for (int i = 0; i < decoded.rows; i++) {
+            // NULL values are left as holes
+            const auto& cell = decoded.cell(i, j);
+            if (cell.kind != Cell::Null) {
+                lua->PushNumber(i + 1);
+                push_cell(lua, cell, decoded.arena.data());
                 lua->SetTable(-3);
             }
         }
+
         lua->SetTable(-3);
     }
-    lua->SetField(-2, "rows");
+    lua->SetField(-2, "columns");
+}
+
+// pushes table with values of the row
+void push_row(GLua::ILuaInterface* lua, const PGresult* result, int row,
+              const std::vector<FieldInfo>& fields, bool array_result) {
+    int nFields = std::min<int>(PQnfields(result), fields.size());
+    lua->CreateTable();
+    for (int j = 0; j < nFields; j++) {
+        // skip NULL values
+        if (!PQgetisnull(result, row, j)) {
+            // field name
+            if (!array_result) {
+                lua->PushString(fields[j].name);
+            } else {
+                lua->PushNumber(j + 1);
+            }
+
+            // field value
+            push_value(lua, result, row, j, fields[j]);
+
+            lua->SetTable(-3);
+        }
+    }
+}
+
+// appends rows of the result into the table on top of the stack
+void add_result_rows(GLua::ILuaInterface* lua, const PGresult* result,
+                     const std::vector<FieldInfo>& fields, bool array_result,
+                     int offset = 0) {
+    int nTuples = PQntuples(result);
+    for (int i = 0; i < nTuples; i++) {
+        lua->PushNumber(offset + i + 1);
+        push_row(lua, result, i, fields, array_result);
+        lua->SetTable(-3);
+    }
+}
+
+// creates table with one array per column in the table on top of the stack,
+// columns are keyed by field name, or by field number with array_result
+void create_columns_table(GLua::ILuaInterface* lua,
+                          const PGresult* const* results, size_t count,
+                          const std::vector<FieldInfo>& fields,
+                          bool array_result) {
+    lua->CreateTable();
+    for (size_t j = 0; j < fields.size(); j++) {
+        if (!array_result) {
+            lua->PushString(fields[j].name);
+        } else {
+            lua->PushNumber(j + 1);
+        }
+
+        lua->CreateTable();
+        int offset = 0;
+        for (size_t k = 0; k < count; k++) {
+            auto result = results[k];
+            int nTuples = PQntuples(result);
+            for (int i = 0; i < nTuples; i++) {
+                // NULL values are left as holes
+                if (!PQgetisnull(result, i, j)) {
+                    lua->PushNumber(offset + i + 1);
+                    push_value(lua, result, i, j, fields[j]);
+                    lua->SetTable(-3);
+                }
+            }
+            offset += nTuples;
+        }
+
+        lua->SetTable(-3);
+    }
+    lua->SetField(-2, "columns");
+}
+
+void async_postgres::create_result_table(GLua::ILuaInterface* lua,
+                                         PGresult* result, bool array_result,
+                                         bool columnar_result) {
+    lua->CreateTable();
+
+    auto fields = create_fields_table(lua, result);
+    auto decoded = get_decoded_result(result);
+
+    if (columnar_result) {
+        if (decoded) {
+            create_decoded_columns_table(lua, *decoded, fields, array_result);
+        } else {
+            create_columns_table(lua, &result, 1, fields, array_result);
+        }
+
+        lua->PushNumber(PQntuples(result));
+        lua->SetField(-2, "count");
+    } else {
+        // Rows
+        lua->CreateTable();
+        if (decoded) {
+            add_decoded_rows(lua, *decoded, fields, array_result);
+        } else {
+            add_result_rows(lua, result, fields, array_result);
+        }
+        lua->SetField(-2, "rows");
+    }
 
     lua->PushString(PQcmdStatus(result));
     lua->SetField(-2, "command");
@@ -70,15 +623,272 @@ void async_postgres::create_result_table(GLua::ILuaInterface* lua,
     lua->SetField(-2, "oid");
 }
 
-#define set_error_field(name, field)                                 \
-    {                                                                \
-        const char* field_value = PQresultErrorField(result, field); \
-        if (field_value) {                                           \
-            lua->PushString(field_value);                            \
-            lua->SetField(-2, name);                                 \
-        }                                                            \
+void async_postgres::create_chunk_table(GLua::ILuaInterface* lua,
+                                        const std::vector<pg::result>& results,
+                                        bool array_result,
+                                        bool columnar_result) {
+    lua->CreateTable();
+
+    // every result in chunk has the same fields
+    auto fields = create_fields_table(lua, results.front().get());
+
+    if (columnar_result) {
+        std::vector<const PGresult*> chunk;
+        int count = 0;
+        for (const auto& result : results) {
+            chunk.push_back(result.get());
+            count += PQntuples(result.get());
+        }
+        create_columns_table(lua, chunk.data(), chunk.size(), fields,
+                             array_result);
+
+        lua->PushNumber(count);
+        lua->SetField(-2, "count");
+    } else {
+        // Rows
+        lua->CreateTable();
+        int offset = 0;
+        for (const auto& result : results) {
+            add_result_rows(lua, result.get(), fields, array_result, offset);
+            offset += PQntuples(result.get());
+        }
+        lua->SetField(-2, "rows");
+    }
+
+    // more rows (or final result) will follow
+    lua->PushBool(true);
+    lua->SetField(-2, "partial");
+}
+
+int async_postgres::result_meta = 0;
+
+// result which converts cells into lua values only when they are accessed
+struct LazyResult {
+    async_postgres::pg::result result;
+    std::vector<FieldInfo> fields;
+    bool array_result;
+};
+
+void async_postgres::create_lazy_result(GLua::ILuaInterface* lua,
+                                        pg::result&& result,
+                                        bool array_result) {
+    auto fields = get_fields(result.get());
+    auto lazy = new LazyResult{std::move(result), std::move(fields),
+                               array_result};
+
+    lua->PushUserType(lazy, result_meta);
+    lua->PushMetaTable(result_meta);
+    lua->SetMetaTable(-2);
+}
+
+#define lua_lazy_result() \
+    lua->GetUserType<LazyResult>(1, async_postgres::result_meta)
+
+inline LazyResult* check_lazy_result(GLua::ILuaInterface* lua) {
+    lua->CheckType(1, async_postgres::result_meta);
+    auto lazy = lua_lazy_result();
+    if (!lazy) {
+        throw std::runtime_error("result was already freed");
+    }
+    return lazy;
+}
+
+// returns zero-based row index, or -1 if row is out of range
+inline int get_row_index(GLua::ILuaInterface* lua, const LazyResult* lazy,
+                         int index) {
+    if (!lua->IsType(index, GLua::Type::Number)) {
+        return -1;
+    }
+
+    int row = static_cast<int>(lua->GetNumber(index)) - 1;
+    if (row < 0 || row >= PQntuples(lazy->result.get())) {
+        return -1;
+    }
+    return row;
+}
+
+// returns zero-based column index, or -1 if there is no such column
+// column can be given as 1-based number or as field name
+inline int get_column_index(GLua::ILuaInterface* lua, const LazyResult* lazy,
+                            int index) {
+    if (lua->IsType(index, GLua::Type::Number)) {
+        int column = static_cast<int>(lua->GetNumber(index)) - 1;
+        return column >= 0 && column < static_cast<int>(lazy->fields.size())
+                   ? column
+                   : -1;
+    }
+
+    // PQfnumber folds case of unquoted names, so names are compared as is
+    auto name = async_postgres::get_string(lua, index);
+    for (size_t i = 0; i < lazy->fields.size(); i++) {
+        if (name == lazy->fields[i].name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// pushes row table, or nil if row is out of range
+inline void push_lazy_row(GLua::ILuaInterface* lua, const LazyResult* lazy,
+                          int row) {
+    if (row < 0) {
+        return lua->PushNil();
+    }
+    push_row(lua, lazy->result.get(), row, lazy->fields, lazy->array_result);
+}
+
+// connection functions are in async_postgres::lua,
+// so result functions need their own namespace
+namespace async_postgres::lua::pgresult {
+    lua_protected_fn(__gc) {
+        delete lua_lazy_result();
+        return 0;
+    }
+
+    lua_protected_fn(__index) {
+        // methods are available even after result was freed,
+        // so free can be called more than once
+        if (lua->IsType(2, GLua::Type::String)) {
+            lua->PushMetaTable(async_postgres::result_meta);
+            lua->Push(2);
+            lua->RawGet(-2);
+            if (!lua->IsType(-1, GLua::Type::Nil)) {
+                return 1;
+            }
+            lua->Pop(2);
+        }
+
+        auto lazy = check_lazy_result(lua);
+        auto result = lazy->result.get();
+
+        if (lua->IsType(2, GLua::Type::Number)) {
+            push_lazy_row(lua, lazy, get_row_index(lua, lazy, 2));
+            return 1;
+        }
+
+        if (!lua->IsType(2, GLua::Type::String)) {
+            lua->PushNil();
+            return 1;
+        }
+
+        auto key = get_string(lua, 2);
+        if (key == "rows") {
+            // rows can be indexed the same way as result itself
+            lua->Push(1);
+        } else if (key == "fields") {
+            push_fields_table(lua, lazy->fields);
+        } else if (key == "command") {
+            lua->PushString(PQcmdStatus(result));
+        } else if (key == "oid") {
+            lua->PushNumber(PQoidValue(result));
+        } else {
+            lua->PushNil();
+        }
+        return 1;
+    }
+
+    lua_protected_fn(__len) {
+        auto lazy = check_lazy_result(lua);
+        lua->PushNumber(PQntuples(lazy->result.get()));
+        return 1;
+    }
+
+    lua_protected_fn(row) {
+        auto lazy = check_lazy_result(lua);
+        lua->CheckType(2, GLua::Type::Number);
+        push_lazy_row(lua, lazy, get_row_index(lua, lazy, 2));
+        return 1;
+    }
+
+    lua_protected_fn(get) {
+        auto lazy = check_lazy_result(lua);
+        lua->CheckType(2, GLua::Type::Number);
+
+        int row = get_row_index(lua, lazy, 2);
+        int column = get_column_index(lua, lazy, 3);
+        auto result = lazy->result.get();
+        if (row < 0 || column < 0 || PQgetisnull(result, row, column)) {
+            lua->PushNil();
+            return 1;
+        }
+
+        push_value(lua, result, row, column, lazy->fields[column]);
+        return 1;
     }
 
+    lua_protected_fn(next_row) {
+        auto lazy = check_lazy_result(lua);
+        lua->CheckType(2, GLua::Type::Number);
+
+        int row = static_cast<int>(lua->GetNumber(2));
+        if (row < 0 || row >= PQntuples(lazy->result.get())) {
+            return 0;
+        }
+
+        lua->PushNumber(row + 1);
+        push_row(lua, lazy->result.get(), row, lazy->fields,
+                 lazy->array_result);
+        return 2;
+    }
+
+    // for i, row in result:iter() do ... end
+    lua_protected_fn(iter) {
+        check_lazy_result(lua);
+        lua->PushCFunction(next_row);
+        lua->Push(1);
+        lua->PushNumber(0);
+        return 3;
+    }
+
+    lua_protected_fn(free) {
+        lua->CheckType(1, async_postgres::result_meta);
+        delete lua_lazy_result();
+        lua->SetUserType(1, nullptr);
+        return 0;
+    }
+}  // namespace async_postgres::lua::pgresult
+
+#define register_lua_fn(name)                                \
+    lua->PushCFunction(async_postgres::lua::pgresult::name); \
+    lua->SetField(-2, #name)
+
+void async_postgres::register_result_mt(GLua::ILuaInterface* lua) {
+    result_meta = lua->CreateMetaTable("PGLazyResult");
+
+    register_lua_fn(__gc);
+    register_lua_fn(__index);
+    register_lua_fn(__len);
+    register_lua_fn(row);
+    register_lua_fn(get);
+    register_lua_fn(iter);
+    register_lua_fn(free);
+
+    lua->Pop();
+}
+
+struct ErrorField {
+    const char* name;
+    int code;
+};
+
+constexpr ErrorField error_fields[] = {
+    {"severity", PG_DIAG_SEVERITY_NONLOCALIZED},
+    {"sqlState", PG_DIAG_SQLSTATE},
+    {"messagePrimary", PG_DIAG_MESSAGE_PRIMARY},
+    {"messageDetail", PG_DIAG_MESSAGE_DETAIL},
+    {"messageHint", PG_DIAG_MESSAGE_HINT},
+    {"statementPosition", PG_DIAG_STATEMENT_POSITION},
+    {"context", PG_DIAG_CONTEXT},
+    {"schemaName", PG_DIAG_SCHEMA_NAME},
+    {"tableName", PG_DIAG_TABLE_NAME},
+    {"columnName", PG_DIAG_COLUMN_NAME},
+    {"dataType", PG_DIAG_DATATYPE_NAME},
+    {"constraintName", PG_DIAG_CONSTRAINT_NAME},
+    {"sourceFile", PG_DIAG_SOURCE_FILE},
+    {"sourceLine", PG_DIAG_SOURCE_LINE},
+    {"sourceFunction", PG_DIAG_SOURCE_FUNCTION},
+};
+
 void async_postgres::create_result_error_table(GLua::ILuaInterface* lua,
                                                const PGresult* result) {
     lua->CreateTable();
@@ -86,19 +896,38 @@ void async_postgres::create_result_error_table(GLua::ILuaInterface* lua,
     lua->PushString(PQresStatus(PQresultStatus(result)));
     lua->SetField(-2, "status");
 
-    set_error_field("severity", PG_DIAG_SEVERITY_NONLOCALIZED);
-    set_error_field("sqlState", PG_DIAG_SQLSTATE);
-    set_error_field("messagePrimary", PG_DIAG_MESSAGE_PRIMARY);
-    set_error_field("messageDetail", PG_DIAG_MESSAGE_DETAIL);
-    set_error_field("messageHint", PG_DIAG_MESSAGE_HINT);
-    set_error_field("statementPosition", PG_DIAG_STATEMENT_POSITION);
-    set_error_field("context", PG_DIAG_CONTEXT);
-    set_error_field("schemaName", PG_DIAG_SCHEMA_NAME);
-    set_error_field("tableName", PG_DIAG_TABLE_NAME);
-    set_error_field("columnName", PG_DIAG_COLUMN_NAME);
-    set_error_field("dataType", PG_DIAG_DATATYPE_NAME);
-    set_error_field("constraintName", PG_DIAG_CONSTRAINT_NAME);
-    set_error_field("sourceFile", PG_DIAG_SOURCE_FILE);
-    set_error_field("sourceLine", PG_DIAG_SOURCE_LINE);
-    set_error_field("sourceFunction", PG_DIAG_SOURCE_FUNCTION);
+    for (const auto& field : error_fields) {
+        const char* value = PQresultErrorField(result, field.code);
+        if (value) {
+            lua->PushString(value);
+            lua->SetField(-2, field.name);
+        }
+    }
+}
+
+async_postgres::Notice* async_postgres::copy_notice(const PGresult* result) {
+    auto notice = new Notice{PQresultErrorMessage(result),
+                             PQresStatus(PQresultStatus(result)), {}};
+
+    for (const auto& field : error_fields) {
+        const char* value = PQresultErrorField(result, field.code);
+        if (value) {
+            notice->fields.emplace_back(field.name, value);
+        }
+    }
+
+    return notice;
+}
+
+void async_postgres::create_notice_error_table(GLua::ILuaInterface* lua,
+                                               const Notice& notice) {
+    lua->CreateTable();
+
+    lua->PushString(notice.status.c_str());
+    lua->SetField(-2, "status");
+
+    for (const auto& [name, value] : notice.fields) {
+        lua->PushString(value.c_str());
+        lua->SetField(-2, name);
+    }
 }
@@ -0,0 +1,273 @@
+#include <cstring>
+#include <list>
+#include <unordered_set>
+
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+struct CacheEntry {
+    // shared with hits which weren't delivered yet
+    std::shared_ptr<PGresult> result;
+    std::vector<std::string> tags;
+    Clock::time_point expires;
+    // memory used by the result and the key
+    size_t size;
+    std::list<std::string>::iterator position;
+};
+
+// results are shared by every connection,
+// least recently used entries are removed when cache is full
+struct ResultCache {
+    // 0 means that cache is disabled
+    size_t capacity = 0;
+    size_t size = 0;
+    // incremented on every invalidation
+    uint64_t generation = 0;
+    // keys of entries with the tag, so invalidation doesn't scan every entry
+    std::unordered_map<std::string, std::unordered_set<std::string>> tagged;
+    // tags of queries which are still running, with number of such queries
+    std::unordered_map<std::string, size_t> running_tags;
+    // generation of the last invalidation of tags of running queries,
+    // removed once no running query has the tag
+    std::unordered_map<std::string, uint64_t> invalidations;
+    // generation at which whole cache was cleared
+    uint64_t cleared = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // keys in order of use, front is the most recently used one
+    std::list<std::string> order;
+    std::unordered_map<std::string, CacheEntry> entries;
+};
+
+ResultCache result_cache;
+
+inline void append_int(std::string& key, int value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void append_part(std::string& key, const char* value) {
+    if (value) {
+        key += value;
+    }
+    key += '\0';
+}
+
+std::string async_postgres::result_cache_key(PGconn* conn,
+                                             std::string_view command,
+                                             const ParamValues& param,
+                                             bool binary) {
+    std::string key;
+    append_part(key, PQhost(conn));
+    append_part(key, PQport(conn));
+    append_part(key, PQdb(conn));
+    append_part(key, PQuser(conn));
+    key += binary ? '1' : '0';
+    key += command;
+    key += '\0';
+
+    for (int i = 0; i < param.length(); i++) {
+        append_int(key, param.types[i]);
+        append_int(key, param.formats[i]);
+        if (!param.values[i]) {
+            append_int(key, -1);
+            continue;
+        }
+
+        // text values don't always have length set
+        size_t length = param.formats[i] == 1 || param.lengths[i] > 0
+                            ? param.lengths[i]
+                            : std::strlen(param.values[i]);
+        append_int(key, length);
+        key.append(param.values[i], length);
+    }
+    return key;
+}
+
+inline void remove_entry(
+    std::unordered_map<std::string, CacheEntry>::iterator entry) {
+    for (const auto& tag : entry->second.tags) {
+        auto keys = result_cache.tagged.find(tag);
+        if (keys == result_cache.tagged.end()) {
+            continue;
+        }
+        keys->second.erase(entry->first);
+        if (keys->second.empty()) {
+            result_cache.tagged.erase(keys);
+        }
+    }
+
+    result_cache.size -= entry->second.size;
+    result_cache.order.erase(entry->second.position);
+    result_cache.entries.erase(entry);
+}
+
+inline void evict_entries(size_t capacity) {
+    while (!result_cache.order.empty() && result_cache.size > capacity) {
+        remove_entry(result_cache.entries.find(result_cache.order.back()));
+    }
+}
+
+std::shared_ptr<PGresult> async_postgres::find_cached_result(
+    const std::string& key) {
+    auto entry = result_cache.entries.find(key);
+    if (entry == result_cache.entries.end()) {
+        result_cache.misses++;
+        return nullptr;
+    }
+
+    if (Clock::now() >= entry->second.expires) {
+        remove_entry(entry);
+        result_cache.misses++;
+        return nullptr;
+    }
+
+    result_cache.order.splice(result_cache.order.begin(), result_cache.order,
+                              entry->second.position);
+    result_cache.hits++;
+    return entry->second.result;
+}
+
+void async_postgres::start_cache_request(CacheRequest& request) {
+    request.generation = result_cache.generation;
+    request.started = true;
+    for (const auto& tag : request.tags) {
+        result_cache.running_tags[tag]++;
+    }
+}
+
+CacheRequest::~CacheRequest() {
+    if (!started) {
+        return;
+    }
+
+    for (const auto& tag : tags) {
+        auto it = result_cache.running_tags.find(tag);
+        if (it != result_cache.running_tags.end() && --it->second == 0) {
+            result_cache.running_tags.erase(it);
+            result_cache.invalidations.erase(tag);
+        }
+    }
+}
+
+void async_postgres::store_cached_result(const CacheRequest& request,
+                                         const PGresult* result) {
+    if (result_cache.capacity == 0 ||
+        PQresultStatus(result) != PGRES_TUPLES_OK) {
+        return;
+    }
+
+    // result might be stale, if tag was invalidated while query was running
+    if (result_cache.cleared > request.generation) {
+        return;
+    }
+    for (const auto& tag : request.tags) {
+        auto it = result_cache.invalidations.find(tag);
+        if (it != result_cache.invalidations.end() &&
+            it->second > request.generation) {
+            return;
+        }
+    }
+
+    // copy doesn't have notice hooks and event data of the original result
+    pg::result copy(PQcopyResult(result, PG_COPYRES_ATTRS | PG_COPYRES_TUPLES),
+                    &PQclear);
+    if (!copy) {
+        return;
+    }
+
+    size_t size = PQresultMemorySize(copy.get()) + request.key.size();
+    if (size > result_cache.capacity) {
+        return;
+    }
+
+    auto existing = result_cache.entries.find(request.key);
+    if (existing != result_cache.entries.end()) {
+        remove_entry(existing);
+    }
+    evict_entries(result_cache.capacity - size);
+
+    auto expires = request.ttl > 0
+                       ? Clock::now() + std::chrono::milliseconds(request.ttl)
+                       : Clock::time_point::max();
+
+    result_cache.order.push_front(request.key);
+    result_cache.entries.emplace(
+        request.key,
+        CacheEntry{{copy.release(), &PQclear}, request.tags, expires, size,
+                   result_cache.order.begin()});
+    result_cache.size += size;
+    for (const auto& tag : request.tags) {
+        result_cache.tagged[tag].insert(request.key);
+    }
+}
+
+void async_postgres::invalidate_cached_results(std::string_view tag) {
+    if (result_cache.capacity == 0) {
+        return;
+    }
+
+    // most notifications aren't about cached results,
+    // they must not cost more than a lookup
+    std::string channel(tag);
+    auto keys = result_cache.tagged.find(channel);
+    bool running = result_cache.running_tags.count(channel) > 0;
+    if (keys == result_cache.tagged.end() && !running) {
+        return;
+    }
+
+    ++result_cache.generation;
+    if (running) {
+        result_cache.invalidations[channel] = result_cache.generation;
+    }
+
+    if (keys != result_cache.tagged.end()) {
+        auto invalidated = std::move(keys->second);
+        result_cache.tagged.erase(keys);
+        for (const auto& key : invalidated) {
+            auto entry = result_cache.entries.find(key);
+            if (entry != result_cache.entries.end()) {
+                remove_entry(entry);
+            }
+        }
+    }
+}
+
+void async_postgres::clear_result_cache() {
+    // running queries are rejected by the generation, tags are still
+    // tracked, since their queries will finish later
+    result_cache.cleared = ++result_cache.generation;
+    result_cache.invalidations.clear();
+    result_cache.tagged.clear();
+    result_cache.entries.clear();
+    result_cache.order.clear();
+    result_cache.size = 0;
+}
+
+bool async_postgres::result_cache_enabled() {
+    return result_cache.capacity > 0;
+}
+
+void async_postgres::set_result_cache_size(size_t capacity) {
+    result_cache.capacity = capacity;
+    evict_entries(capacity);
+}
+
+void async_postgres::create_result_cache_table(GLua::ILuaInterface* lua) {
+    lua->CreateTable();
+
+    lua->PushNumber(result_cache.capacity);
+    lua->SetField(-2, "capacity");
+
+    lua->PushNumber(result_cache.size);
+    lua->SetField(-2, "size");
+
+    lua->PushNumber(result_cache.entries.size());
+    lua->SetField(-2, "entries");
+
+    lua->PushNumber(result_cache.hits);
+    lua->SetField(-2, "hits");
+
+    lua->PushNumber(result_cache.misses);
+    lua->SetField(-2, "misses");
+}
@@ -0,0 +1,35 @@
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+using Clock = std::chrono::steady_clock;
+
+// 0 means that loop processes everything it can in one tick
+int64_t tick_budget = 0;
+Clock::time_point tick_deadline;
+// connection which will be processed first in the next tick
+size_t next_start = 0;
+
+void async_postgres::set_tick_budget(int64_t microseconds) {
+    tick_budget = std::max<int64_t>(microseconds, 0);
+}
+
+int64_t async_postgres::get_tick_budget() { return tick_budget; }
+
+size_t async_postgres::begin_tick() {
+    if (tick_budget > 0) {
+        tick_deadline = Clock::now() + std::chrono::microseconds(tick_budget);
+    }
+
+    return connections.empty() ? 0 : next_start % connections.size();
+}
+
+void async_postgres::end_tick(size_t start, size_t processed) {
+    // if tick ran out of time, continue with the first skipped connection,
+    // otherwise rotate start, so every connection gets to be the first one
+    next_start = processed < connections.size() ? start + processed : start + 1;
+}
+
+bool async_postgres::tick_budget_exceeded() {
+    return tick_budget > 0 && Clock::now() >= tick_deadline;
+}
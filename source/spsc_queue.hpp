@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace async_postgres {
+    /// Lock-free bounded queue for passing values between two threads.
+    /// Only one thread may push values, and only one thread may pop them.
+    template <typename T, size_t Capacity>
+    class SpscQueue {
+       public:
+        // returns false if queue is full
+        bool push(const T& value) {
+            auto tail = this->tail.load(std::memory_order_relaxed);
+            auto next = (tail + 1) % Capacity;
+            if (next == this->head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            items[tail] = value;
+            this->tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // returns false if queue is empty
+        bool pop(T& value) {
+            auto head = this->head.load(std::memory_order_relaxed);
+            if (head == this->tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            value = items[head];
+            this->head.store((head + 1) % Capacity, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head.load(std::memory_order_acquire) ==
+                   tail.load(std::memory_order_acquire);
+        }
+
+       private:
+        std::array<T, Capacity> items = {};
+        // keep indices on separate cache lines, so threads won't fight over
+        alignas(64) std::atomic<size_t> head = 0;
+        alignas(64) std::atomic<size_t> tail = 0;
+    };
+}  // namespace async_postgres
@@ -0,0 +1,101 @@
+#include "async_postgres.hpp"
+
+using namespace async_postgres;
+
+// same SQL with different param types needs a different statement
+inline std::string cache_key(const CachedCommand& command) {
+    std::string key = command.command;
+    key += '\0';
+    key.append(reinterpret_cast<const char*>(command.param.types.data()),
+               command.param.types.size() * sizeof(Oid));
+    return key;
+}
+
+inline std::shared_ptr<Query> deallocate_query(const std::string& name) {
+    auto query = std::make_shared<Query>(SimpleCommand{"DEALLOCATE " + name});
+    query->internal = true;
+    return query;
+}
+
+// removes least recently used statement from the cache,
+// and returns query which deallocates it on the server
+inline std::shared_ptr<Query> evict_statement(StatementCache& cache) {
+    auto entry = cache.entries.find(cache.order.back());
+    auto query = deallocate_query(entry->second.name);
+
+    cache.entries.erase(entry);
+    cache.order.pop_back();
+
+    return query;
+}
+
+void async_postgres::prepare_cached_statement(Connection* state,
+                                              size_t index) {
+    auto query = state->queries[index];
+    auto command = std::get_if<CachedCommand>(&query->command);
+    if (!command) {
+        return;
+    }
+
+    auto& cache = state->statements;
+    auto key = cache_key(*command);
+
+    auto it = cache.entries.find(key);
+    if (it != cache.entries.end()) {
+        cache.order.splice(cache.order.begin(), cache.order,
+                           it->second.position);
+        command->name = it->second.name;
+        return;
+    }
+
+    // DEALLOCATE is sent after queries which might still use the statement
+    std::vector<std::shared_ptr<Query>> inserted;
+    while (!cache.entries.empty() &&
+           cache.entries.size() >= std::max<size_t>(cache.capacity, 1)) {
+        inserted.push_back(evict_statement(cache));
+    }
+
+    auto name = "async_postgres_" + std::to_string(cache.next_id++);
+
+    CreatePreparedCommand prepare;
+    prepare.name = name;
+    prepare.command = command->command;
+    prepare.types = command->param.types;
+    inserted.push_back(std::make_shared<Query>(std::move(prepare)));
+    inserted.back()->internal = true;
+
+    cache.order.push_front(std::move(key));
+    cache.entries.emplace(cache.order.front(),
+                          StatementCache::Entry{name, cache.order.begin()});
+    command->name = std::move(name);
+
+    state->queries.insert(state->queries.begin() + index, inserted.begin(),
+                          inserted.end());
+}
+
+void async_postgres::invalidate_cached_statement(Connection* state,
+                                                 const std::string& name) {
+    auto& cache = state->statements;
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+        if (it->second.name == name) {
+            cache.order.erase(it->second.position);
+            cache.entries.erase(it);
+            return;
+        }
+    }
+}
+
+void async_postgres::clear_statement_cache(Connection* state) {
+    state->statements.entries.clear();
+    state->statements.order.clear();
+}
+
+void async_postgres::set_statement_cache_size(Connection* state,
+                                              size_t capacity) {
+    auto& cache = state->statements;
+    cache.capacity = capacity;
+
+    while (cache.entries.size() > capacity) {
+        state->queries.push_back(evict_statement(cache));
+    }
+}
@@ -1,5 +1,9 @@
 #include <Platform.hpp>
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
 #include "async_postgres.hpp"
 
 using namespace async_postgres;
@@ -33,25 +37,138 @@ void async_postgres::pcall(GLua::ILuaInterface* lua, int nargs, int nresults) {
     lua->Pop();  // ErrorNoHaltWithStack
 }
 
+// Oids are taken from catalog/pg_type_d.h
+constexpr Oid BOOLOID = 16;
+constexpr Oid BYTEAOID = 17;
+constexpr Oid INT8OID = 20;
+constexpr Oid FLOAT8OID = 701;
+
+void ParamValues::resize(int n_params) {
+    arena.clear();
+    pinned.clear();
+    offsets.assign(n_params, NO_OFFSET);
+    values.assign(n_params, nullptr);
+    lengths.assign(n_params, 0);
+    formats.assign(n_params, 0);
+    types.assign(n_params, 0);
+}
+
+void ParamValues::set_value(int i, std::string_view value) {
+    offsets[i] = arena.size();
+    lengths[i] = value.size();
+    arena.insert(arena.end(), value.begin(), value.end());
+    // text values are read until null terminator
+    arena.push_back('\0');
+}
+
+void ParamValues::pin_value(GLua::ILuaInterface* lua, int i) {
+    // lua strings are immutable and never moved by GC,
+    // so pointer is valid until reference is freed
+    auto value = get_string(lua, -1);
+    pinned.emplace_back(lua, -1);
+    offsets[i] = NO_OFFSET;
+    values[i] = value.data();
+    lengths[i] = value.size();
+}
+
+void ParamValues::bind_values() {
+    for (size_t i = 0; i < offsets.size(); i++) {
+        if (offsets[i] != NO_OFFSET) {
+            values[i] = arena.data() + offsets[i];
+        }
+    }
+}
+
+// values in binary format are sent in network byte order
+inline void set_be_value(ParamValues& param, int i, std::uint64_t value) {
+    char buffer[8];
+    for (int j = 7; j >= 0; j--) {
+        buffer[j] = static_cast<char>(value & 0xFF);
+        value >>= 8;
+    }
+    param.set_value(i, {buffer, sizeof(buffer)});
+}
+
+inline void set_string_param(GLua::ILuaInterface* lua, ParamValues& param,
+                             int i, const ParamOptions& options) {
+    auto value = get_string(lua, -1);
+    if (options.pin_size > 0 && value.size() >= options.pin_size) {
+        param.pin_value(lua, i);
+    } else {
+        param.set_value(i, value);
+    }
+}
+
+inline void encode_typed_param(GLua::ILuaInterface* lua, ParamValues& param,
+                               int i, const ParamOptions& options) {
+    auto type = lua->GetType(-1);
+    if (type == GLua::Type::String) {
+        set_string_param(lua, param, i, options);
+        if (options.bytea) {
+            param.formats[i] = 1;
+            param.types[i] = options.with_types ? BYTEAOID : 0;
+        }
+    } else if (type == GLua::Type::Number && !options.with_types) {
+        param.set_value(i, get_string(lua, -1));
+    } else if (type == GLua::Type::Number) {
+        double number = lua->GetNumber(-1);
+        // integers which fit into int8 are sent as int8
+        if (std::floor(number) == number && number >= -9.2e18 &&
+            number <= 9.2e18) {
+            set_be_value(param, i, static_cast<std::int64_t>(number));
+            param.types[i] = INT8OID;
+        } else {
+            std::uint64_t bits = 0;
+            std::memcpy(&bits, &number, sizeof(number));
+            set_be_value(param, i, bits);
+            param.types[i] = FLOAT8OID;
+        }
+        param.formats[i] = 1;
+    } else if (type == GLua::Type::Bool && !options.with_types) {
+        param.values[i] = lua->GetBool(-1) ? "true" : "false";
+    } else if (type == GLua::Type::Bool) {
+        param.values[i] = lua->GetBool(-1) ? "\1" : "\0";
+        param.lengths[i] = 1;
+        param.formats[i] = 1;
+        param.types[i] = BOOLOID;
+    } else if (type == GLua::Type::Nil) {
+        param.values[i] = nullptr;
+    } else {
+        throw std::runtime_error("unsupported type given into params array");
+    }
+}
+
 ParamValues async_postgres::array_to_params(GLua::ILuaInterface* lua,
-                                            int index) {
+                                            int index,
+                                            const ParamOptions& options) {
+    ParamValues param;
+    array_to_params(lua, index, options, param);
+    return param;
+}
+
+void async_postgres::array_to_params(GLua::ILuaInterface* lua, int index,
+                                     const ParamOptions& options,
+                                     ParamValues& param) {
     lua->Push(index);
     int len = lua->ObjLen(-1);
 
-    ParamValues param(len);
+    param.resize(len);
     for (int i = 0; i < len; i++) {
         lua->PushNumber(i + 1);
         lua->GetTable(-2);
 
+        if (options.typed) {
+            encode_typed_param(lua, param, i, options);
+            lua->Pop(1);
+            continue;
+        }
+
         auto type = lua->GetType(-1);
         if (type == GLua::Type::String) {
-            param.strings[i] = get_string(lua, -1);
-            param.values[i] = param.strings[i].c_str();
-            param.lengths[i] = param.strings[i].length();
+            set_string_param(lua, param, i, options);
             param.formats[i] = 1;
         } else if (type == GLua::Type::Number) {
-            param.strings[i] = get_string(lua, -1);
-            param.values[i] = param.strings[i].c_str();
+            param.set_value(i, get_string(lua, -1));
         } else if (type == GLua::Type::Bool) {
             param.values[i] = lua->GetBool(-1) ? "true" : "false";
         } else if (type == GLua::Type::Nil) {
@@ -65,7 +182,7 @@ ParamValues async_postgres::array_to_params(GLua::ILuaInterface* lua,
     }
 
     lua->Pop(1);
-    return param;
+    param.bind_values();
 }
 
 #if SYSTEM_IS_WINDOWS
@@ -76,27 +193,6 @@ ParamValues async_postgres::array_to_params(GLua::ILuaInterface* lua,
 #define SOCKET int
 #endif
 
-SocketStatus async_postgres::check_socket_status(PGconn* conn) {
-    SocketStatus status = {};
-    SOCKET fd = PQsocket(conn);
-    if (fd < 0) {
-        status.failed = true;
-        return status;
-    }
-
-    pollfd fds[1] = {{fd, POLLIN | POLLOUT, 0}};
-    if (poll(fds, 1, 0) < 0) {
-        status.failed = true;
-    } else {
-        status.read_ready = fds[0].revents & POLLIN;
-        status.write_ready = fds[0].revents & POLLOUT;
-        status.failed = fds[0].revents & POLLERR || fds[0].revents & POLLHUP ||
-                        fds[0].revents & POLLNVAL;
-    }
-
-    return status;
-}
-
 bool async_postgres::wait_for_socket(PGconn* conn, bool write, bool read,
                                      int timeout) {
     SOCKET fd = PQsocket(conn);
@@ -0,0 +1,402 @@
+#include <Platform.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "async_postgres.hpp"
+
+#if SYSTEM_IS_WINDOWS
+#include <WinSock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#define SOCKET int
+#endif
+
+using namespace async_postgres;
+
+// how long worker waits for sockets, this also limits
+// how long new queries will wait before being sent
+constexpr int WORKER_POLL_TIMEOUT = 1;
+
+// connections are attached/detached rarely, so simple mutex is enough,
+// results are passed through lock-free queues
+std::mutex worker_mutex;
+std::atomic<int> worker_waiters = 0;
+std::vector<Connection*> worker_connections = {};
+std::thread worker_thread;
+std::atomic<bool> worker_running = false;
+
+// main thread waits for results in get_result,
+// worker wakes it up after every pass over connections
+std::mutex result_mutex;
+std::condition_variable result_condition;
+std::atomic<int> result_waiters = 0;
+
+// worker takes the mutex again as soon as it releases it,
+// so main thread must tell that it wants to take it
+inline void lock_worker() {
+    worker_waiters++;
+    worker_mutex.lock();
+    worker_waiters--;
+}
+
+struct WorkerLock {
+    WorkerLock() { lock_worker(); }
+    ~WorkerLock() { worker_mutex.unlock(); }
+};
+
+ConnectionLock::ConnectionLock(Connection* state) : locked(!!state->worker) {
+    if (locked) {
+        lock_worker();
+    }
+}
+
+ConnectionLock::~ConnectionLock() {
+    if (locked) {
+        worker_mutex.unlock();
+    }
+}
+
+WorkerConnection::~WorkerConnection() {
+    // values which were never delivered to the main thread
+    PGresult* result;
+    while (results.pop(result)) {
+        PQclear(result);
+    }
+    for (auto* result : pending_results) {
+        PQclear(result);
+    }
+
+    PGnotify* notify;
+    while (notifications.pop(notify)) {
+        PQfreemem(notify);
+    }
+    for (auto* notify : pending_notifications) {
+        PQfreemem(notify);
+    }
+
+    Notice* notice;
+    while (notices.pop(notice)) {
+        delete notice;
+    }
+    for (auto* notice : pending_notices) {
+        delete notice;
+    }
+}
+
+// pushes value into the queue, or keeps it until there is space
+template <typename T, size_t N>
+inline void push_deferred(SpscQueue<T, N>& queue, std::deque<T>& pending,
+                          T value) {
+    if (!pending.empty() || !queue.push(value)) {
+        pending.push_back(value);
+    }
+}
+
+template <typename T, size_t N>
+inline void flush_deferred(SpscQueue<T, N>& queue, std::deque<T>& pending) {
+    while (!pending.empty() && queue.push(pending.front())) {
+        pending.pop_front();
+    }
+}
+
+// called by libpq inside worker thread, lua can't be used here
+static void workerNoticeReceiver(void* arg, const PGresult* res) {
+    auto worker = static_cast<WorkerConnection*>(arg);
+    push_deferred(worker->notices, worker->pending_notices, copy_notice(res));
+}
+
+inline void send_worker_queries(Connection* state) {
+    auto& worker = *state->worker;
+    auto conn = state->conn.get();
+
+    while (!worker.unsent.empty() &&
+           (state->pipeline || worker.sent.empty())) {
+        auto query = worker.unsent.front();
+        worker.unsent.pop_front();
+
+        if (!send_query(conn, query, state->pipeline) ||
+            (state->pipeline && PQpipelineSync(conn) == 0)) {
+            // report error to the main thread like it came from the server
+            push_deferred(worker.results, worker.pending_results,
+                          PQmakeEmptyPGresult(conn, PGRES_FATAL_ERROR));
+            push_deferred(
+                worker.results, worker.pending_results,
+                state->pipeline ? PQmakeEmptyPGresult(conn, PGRES_PIPELINE_SYNC)
+                                : nullptr);
+            continue;
+        }
+
+        if (query->chunk_size > 0 &&
+            (!state->pipeline || worker.sent.empty())) {
+            set_row_mode(conn, query->chunk_size);
+        }
+
+        worker.sent.push_back(query);
+        worker.flushed = false;
+    }
+
+    if (!worker.flushed) {
+        worker.flushed = PQflush(conn) == 0;
+    }
+}
+
+inline void process_worker_connection(Connection* state) {
+    auto& worker = *state->worker;
+    auto conn = state->conn.get();
+    if (worker.broken) {
+        return;
+    }
+
+    flush_deferred(worker.results, worker.pending_results);
+    flush_deferred(worker.notifications, worker.pending_notifications);
+    flush_deferred(worker.notices, worker.pending_notices);
+
+    Query* query;
+    while (worker.submissions.pop(query)) {
+        worker.unsent.push_back(query);
+    }
+
+    send_worker_queries(state);
+
+    // main thread is behind, stop reading from socket
+    if (!worker.pending_results.empty()) {
+        return;
+    }
+
+    if (worker.readable) {
+        worker.readable = false;
+        // on error libpq will return error result from PQgetResult
+        PQconsumeInput(conn);
+    }
+
+    while (!worker.sent.empty() && worker.pending_results.empty() &&
+           !PQisBusy(conn)) {
+        auto result = PQgetResult(conn);
+
+        bool done = state->pipeline ? result && PQresultStatus(result) ==
+                                                    PGRES_PIPELINE_SYNC
+                                    : !result;
+
+        // connection was lost, sync results will never arrive
+        if (state->pipeline && !result && PQstatus(conn) == CONNECTION_BAD) {
+            worker.broken = true;
+            push_deferred(worker.results, worker.pending_results, result);
+            break;
+        }
+
+        // values are converted here, so main thread only has to push them
+        if (result && !worker.sent.front()->lazy_result) {
+            decode_result(result);
+        }
+        push_deferred(worker.results, worker.pending_results, result);
+
+        if (done) {
+            worker.sent.pop_front();
+            send_worker_queries(state);
+        }
+    }
+
+    while (auto notify = PQnotifies(conn)) {
+        push_deferred(worker.notifications, worker.pending_notifications,
+                      notify);
+    }
+}
+
+void worker_loop() {
+    std::vector<pollfd> fds;
+    std::vector<Connection*> polled;
+
+    while (worker_running) {
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+
+            fds.clear();
+            polled.clear();
+            for (auto* state : worker_connections) {
+                process_worker_connection(state);
+
+                auto& worker = *state->worker;
+                if (worker.broken) {
+                    continue;
+                }
+
+                SOCKET fd = PQsocket(state->conn.get());
+                if (fd < 0) {
+                    continue;
+                }
+
+                short events = worker.pending_results.empty() ? POLLIN : 0;
+                if (!worker.flushed) {
+                    events |= POLLOUT;
+                }
+
+                fds.push_back({fd, events, 0});
+                polled.push_back(state);
+            }
+        }
+
+        if (result_waiters > 0) {
+            std::lock_guard<std::mutex> lock(result_mutex);
+            result_condition.notify_all();
+        }
+
+        // sockets are polled without the lock, so main thread
+        // can use connections in the meantime
+        if (fds.empty()) {
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(WORKER_POLL_TIMEOUT));
+        } else if (poll(fds.data(), fds.size(), WORKER_POLL_TIMEOUT) > 0) {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            for (size_t i = 0; i < fds.size(); i++) {
+                // connection might have been detached while it was polled
+                auto it = std::find(worker_connections.begin(),
+                                    worker_connections.end(), polled[i]);
+                if (it != worker_connections.end()) {
+                    polled[i]->worker->readable =
+                        fds[i].revents & (POLLIN | POLLERR | POLLHUP);
+                }
+            }
+        }
+
+        // let main thread take the lock
+        while (worker_waiters > 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void async_postgres::attach_worker(Connection* state) {
+    if (state->worker) {
+        return;
+    }
+
+    auto worker = std::make_unique<WorkerConnection>();
+    worker->flushed = state->flushed;
+    register_result_events(state->conn.get());
+    worker->main_notice_receiver = PQsetNoticeReceiver(
+        state->conn.get(), workerNoticeReceiver, worker.get());
+
+    {
+        WorkerLock lock;
+        state->worker = std::move(worker);
+        worker_connections.push_back(state);
+    }
+
+    if (!worker_running) {
+        worker_running = true;
+        worker_thread = std::thread(worker_loop);
+    }
+}
+
+void async_postgres::detach_worker(Connection* state) {
+    if (!state->worker) {
+        return;
+    }
+
+    {
+        WorkerLock lock;
+        worker_connections.erase(std::find(worker_connections.begin(),
+                                           worker_connections.end(), state));
+    }
+
+    // worker doesn't touch connection anymore
+    auto& worker = *state->worker;
+    PQsetNoticeReceiver(state->conn.get(), worker.main_notice_receiver,
+                        state);
+    state->flushed = worker.flushed;
+
+    // notifications and notices are delivered by the main thread later,
+    // results belong to sent queries, which are failed by the caller
+    PGnotify* notify;
+    while (worker.notifications.pop(notify)) {
+        state->detached_notifications.emplace_back(notify, &PQfreemem);
+    }
+    for (auto* notify : worker.pending_notifications) {
+        state->detached_notifications.emplace_back(notify, &PQfreemem);
+    }
+    worker.pending_notifications.clear();
+
+    Notice* notice;
+    while (worker.notices.pop(notice)) {
+        state->detached_notices.emplace_back(notice);
+    }
+    for (auto* notice : worker.pending_notices) {
+        state->detached_notices.emplace_back(notice);
+    }
+    worker.pending_notices.clear();
+
+    state->worker.reset();
+
+    if (worker_connections.empty()) {
+        stop_worker();
+    }
+}
+
+void async_postgres::stop_worker() {
+    if (worker_running) {
+        worker_running = false;
+        worker_thread.join();
+    }
+}
+
+void async_postgres::set_threaded_io(GLua::ILuaInterface* lua,
+                                     Connection* state, bool enabled) {
+    if (state->threaded == enabled) {
+        return;
+    }
+
+    // queries which weren't sent yet will be sent by the new owner
+    if (!state->queries.empty() && state->queries.front()->sent) {
+        throw std::runtime_error(
+            "threaded I/O can't be changed while queries are in progress");
+    }
+
+    state->threaded = enabled;
+
+    // worker will be attached after reset is finished
+    if (state->reset_event) {
+        return;
+    }
+
+    if (enabled) {
+        attach_worker(state);
+    } else {
+        // deliver notifications which were received by worker
+        process_notifications(lua, state);
+        detach_worker(state);
+    }
+}
+
+bool async_postgres::result_ready(Connection* state) {
+    if (state->held_result) {
+        return true;
+    }
+    if (state->worker) {
+        return !state->worker->results.empty();
+    }
+    return !pg::isBusy(state->conn);
+}
+
+pg::result async_postgres::get_result(Connection* state) {
+    if (state->held_result) {
+        return std::move(state->held_result);
+    }
+    if (!state->worker) {
+        return pg::getResult(state->conn);
+    }
+
+    // wait until worker receives result, like PQgetResult does
+    PGresult* result = nullptr;
+    auto& results = state->worker->results;
+    if (!results.pop(result)) {
+        std::unique_lock<std::mutex> lock(result_mutex);
+        result_waiters++;
+        result_condition.wait(lock, [&] { return results.pop(result); });
+        result_waiters--;
+    }
+    return pg::result(result, &PQclear);
+}